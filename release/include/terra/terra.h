@@ -18,6 +18,8 @@ typedef struct { /* default values are 0 */
     int debug;   /*-g, turn on debugging symbols and base pointers */
     int usemcjit;
     char *cmd_line_chunk;
+    int perf; /*-P, write /tmp/perf-<pid>.map for linux perf, -PP also writes a jitdump
+                 with code and line tables */
 } terra_Options;
 int terra_initwithoptions(lua_State *L, terra_Options *options);
 
@@ -179,6 +179,7 @@ typedef struct LexState {
                     suppress the duplicate addition of context information */
     char lextable; /* &lextable is the registry key for lua state associated with the
                       LexState object*/
+    const char *treeskey; /* key of this chunk's table in _G.terra._trees */
 } LexState;
 
 LUAI_FUNC void luaX_init(terra_State *L);
@@ -207,6 +208,7 @@ enum TA_Globals {
     TA_ENTRY_POINT_TABLE,
     TA_LANGUAGES_TABLE,
     TA_TYPE_TABLE,
+    TA_NODE_CACHE,
     TA_LAST_GLOBAL
 };
 // accessors for lua state assocated with the Terra lexer
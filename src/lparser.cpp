@@ -7,6 +7,7 @@
 #include <string.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <time.h>
 
 #define lparser_c
 #define LUA_CORE
@@ -88,8 +89,10 @@ static int new_table(LexState *ls) {
 }
 static int new_list(LexState *ls) {
     if (ls->in_terra) {
+        // equivalent to calling terra.newlist(), which just sets List as the metatable
+        lua_newtable(ls->L);
         luaX_globalpush(ls, TA_NEWLIST);
-        lua_call(ls->L, 0, 1);
+        lua_setmetatable(ls->L, -2);
         return lua_gettop(ls->L);
     } else
         return 0;
@@ -136,35 +139,89 @@ static Position getposition(LexState *ls) {
     return p;
 }
 
-static void table_setposition(LexState *ls, int t, Position p) {
+// slots of the TA_NODE_CACHE table, which otherwise maps the address of a kind name to
+// a table { class, fieldname1, ..., fieldnameN, hasinit }
+enum { NODE_LINENUMBER = 1, NODE_OFFSET, NODE_FILENAME, NODE_SOURCE };
+
+static void table_setposition(LexState *ls, int cache, int t, Position p) {
+    lua_rawgeti(ls->L, cache, NODE_LINENUMBER);
     lua_pushinteger(ls->L, p.linenumber);
-    lua_setfield(ls->L, t, "linenumber");
+    lua_rawset(ls->L, t);
+    lua_rawgeti(ls->L, cache, NODE_OFFSET);
     lua_pushinteger(ls->L, p.offset);
-    lua_setfield(ls->L, t, "offset");
-    lua_pushstring(ls->L, getstr(ls->source));
-    lua_setfield(ls->L, t, "filename");
-}
-
-static int newobjecterror(lua_State *L) {
-    printf("newobjecterror: %s\n", lua_tostring(L, -1));
-    exit(1);
+    lua_rawset(ls->L, t);
+    lua_rawgeti(ls->L, cache, NODE_FILENAME);
+    lua_rawgeti(ls->L, cache, NODE_SOURCE);
+    lua_rawset(ls->L, t);
 }
 
+// look up the class for kind k and the names of its fields, leaving the cache entry on
+// the stack
+static void new_nodekind(LexState *ls, int cache, const char *k) {
+    lua_State *L = ls->L;
+    luaX_globalgetfield(ls, TA_TYPE_TABLE, k);
+    int cls = lua_gettop(L);
+    assert(!lua_isnil(L, cls));
+    lua_getfield(L, cls, "__fields");
+    int nfields = lua_isnil(L, -1) ? 0 : (int)lua_objlen(L, -1);
+    lua_createtable(L, nfields + 2, 0);
+    lua_pushvalue(L, cls);
+    lua_rawseti(L, -2, 1);
+    for (int i = 1; i <= nfields; i++) {
+        lua_rawgeti(L, -2, i);
+        lua_getfield(L, -1, "name");
+        lua_rawseti(L, -3, i + 1);
+        lua_pop(L, 1);
+    }
+    lua_getfield(L, cls, "init");
+    lua_pushboolean(L, !lua_isnil(L, -1));
+    lua_rawseti(L, -3, nfields + 2);
+    lua_pop(L, 1);
+    lua_replace(L, cls);  // entry replaces class
+    lua_pop(L, 1);        // __fields
+    lua_pushlightuserdata(L, (void *)k);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, cache);
+}
+
+// Builds the node directly rather than calling the ASDL constructor: the parser only
+// passes arguments of the right types, so the constructor's checks (and the lua_pcall
+// needed to run them) are skipped. k must be a string literal, its address is the cache
+// key.
 static int new_object(LexState *ls, const char *k, int N, Position *p) {
     if (ls->in_terra) {
-        luaX_globalgetfield(ls, TA_TYPE_TABLE, k);
-        lua_insert(ls->L, -(N + 1));
-
-        lua_pushcfunction(ls->L, newobjecterror);
-        lua_insert(ls->L, -(N + 2));
-
-        lua_pcall(ls->L, N, 1, -(N + 2));
-
-        table_setposition(ls, lua_gettop(ls->L), *p);
-
-        lua_remove(ls->L, -2);
-
-        return lua_gettop(ls->L);
+        lua_State *L = ls->L;
+        int args = lua_gettop(L) - N + 1;
+        luaX_globalpush(ls, TA_NODE_CACHE);
+        int cache = lua_gettop(L);
+        lua_pushlightuserdata(L, (void *)k);
+        lua_rawget(L, cache);
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            new_nodekind(ls, cache, k);
+        }
+        int entry = cache + 1;
+        lua_createtable(L, 0, N + 3);
+        int obj = entry + 1;
+        for (int i = 0; i < N; i++) {
+            if (lua_isnil(L, args + i)) continue;
+            lua_rawgeti(L, entry, i + 2);
+            lua_pushvalue(L, args + i);
+            lua_rawset(L, obj);
+        }
+        table_setposition(ls, cache, obj, *p);
+        lua_rawgeti(L, entry, 1);
+        lua_setmetatable(L, obj);
+        lua_rawgeti(L, entry, (int)lua_objlen(L, entry));
+        if (lua_toboolean(L, -1)) {
+            lua_getfield(L, obj, "init");
+            lua_pushvalue(L, obj);
+            lua_call(L, 1, 0);
+        }
+        lua_pop(L, 1);
+        lua_replace(L, args);
+        lua_settop(L, args);
+        return args;
     } else
         return 0;
 }
@@ -653,12 +710,22 @@ static void print_stack(lua_State * L, int idx) {
 }
 #endif
 
-// store the lua object on the top of the stack to to the _G.terra._trees table, returning
-// its index in the table
+// store the lua object on the top of the stack to to the _G.terra._trees[treeskey] table
+// of this chunk, returning its index in the table
 static int store_value(LexState *ls) {
     int i = 0;
     if (ls->in_terra) {
         luaX_globalpush(ls, TA_FUNCTION_TABLE);
+        if (lua_isnil(ls->L, -1)) {  // first tree of this chunk
+            lua_pop(ls->L, 1);
+            lua_newtable(ls->L);
+            luaX_globalgetfield(ls, TA_TERRA_OBJECT, "_trees");
+            lua_pushvalue(ls->L, -2);
+            lua_setfield(ls->L, -2, ls->treeskey);
+            lua_pop(ls->L, 1);
+            lua_pushvalue(ls->L, -1);
+            luaX_globalset(ls, TA_FUNCTION_TABLE);
+        }
         lua_insert(ls->L, -2);
         i = add_entry(ls, lua_gettop(ls->L) - 1);
         lua_pop(ls->L, 1); /*remove function table*/
@@ -670,7 +737,8 @@ static void printtreesandnames(LexState *ls, std::vector<int> *trees,
                                std::vector<TString *> *names) {
     OutputBuffer_printf(&ls->output_buffer, "{");
     for (size_t i = 0; i < trees->size(); i++) {
-        OutputBuffer_printf(&ls->output_buffer, "_G.terra._trees[%d]", (*trees)[i]);
+        OutputBuffer_printf(&ls->output_buffer, "_G.terra._trees.%s[%d]", ls->treeskey,
+                            (*trees)[i]);
         if (i + 1 < trees->size()) OutputBuffer_putc(&ls->output_buffer, ',');
     }
     OutputBuffer_printf(&ls->output_buffer, "},{");
@@ -913,8 +981,8 @@ static void print_captured_locals(LexState *ls, TerraCnt *tc) {
     }
     int defined = store_value(ls);
     ls->in_terra = in_terra;
-    OutputBuffer_printf(&ls->output_buffer, " },_G.terra._trees[%d],getfenv()) end",
-                        defined);
+    OutputBuffer_printf(&ls->output_buffer, " },_G.terra._trees.%s[%d],getfenv()) end",
+                        ls->treeskey, defined);
 }
 
 static void doquote(LexState *ls, int isexp) {
@@ -948,8 +1016,8 @@ static void doquote(LexState *ls, int isexp) {
 
     luaX_patchbegin(ls, &begin);
     int id = store_value(ls);
-    OutputBuffer_printf(&ls->output_buffer, "(terra.definequote(_G.terra._trees[%d],",
-                        id);
+    OutputBuffer_printf(&ls->output_buffer, "(terra.definequote(_G.terra._trees.%s[%d],",
+                        ls->treeskey, id);
     print_captured_locals(ls, &tc);
     OutputBuffer_printf(&ls->output_buffer, "))");
     luaX_patchend(ls, &begin);
@@ -1063,7 +1131,8 @@ static void simpleexp(LexState *ls) {
             luaX_patchbegin(ls, &begin);
             int id = store_value(ls);
             OutputBuffer_printf(&ls->output_buffer,
-                                "terra.anonfunction(_G.terra._trees[%d],", id);
+                                "terra.anonfunction(_G.terra._trees.%s[%d],", ls->treeskey,
+                                id);
             print_captured_locals(ls, &tc);
             OutputBuffer_printf(&ls->output_buffer, ")");
             luaX_patchend(ls, &begin);
@@ -1089,7 +1158,8 @@ static void simpleexp(LexState *ls) {
 
             luaX_patchbegin(ls, &begin);
             OutputBuffer_printf(&ls->output_buffer,
-                                "terra.anonstruct(_G.terra._trees[%d],", id);
+                                "terra.anonstruct(_G.terra._trees.%s[%d],", ls->treeskey,
+                                id);
             print_captured_locals(ls, &tc);
             OutputBuffer_printf(&ls->output_buffer, ")");
             luaX_patchend(ls, &begin);
@@ -1788,8 +1858,8 @@ static void terrastats(LexState *ls, bool emittedlocal) {
         Name *name = &names[i];
         OutputBuffer_printf(&ls->output_buffer, ", \"");
         Name_print(name, ls);
-        OutputBuffer_printf(&ls->output_buffer, "\", _G.terra._trees[%d]",
-                            defs[i].treeid);
+        OutputBuffer_printf(&ls->output_buffer, "\", _G.terra._trees.%s[%d]",
+                            ls->treeskey, defs[i].treeid);
     }
     OutputBuffer_putc(&ls->output_buffer, ')');
     luaX_patchend(ls, &begin);
@@ -2018,7 +2088,10 @@ static int le_cur(lua_State *L) {
             (const LexState *)lua_topointer(L, lua_upvalueindex(1)));
     converttokentolua(ls, &ls->t);
     Position p = getposition(ls);
-    table_setposition(ls, lua_gettop(ls->L), p);
+    int t = lua_gettop(ls->L);
+    luaX_globalpush(ls, TA_NODE_CACHE);
+    table_setposition(ls, t + 1, t, p);
+    lua_pop(ls->L, 1);
     return 1;
 }
 static int le_lookahead(lua_State *L) {
@@ -2136,7 +2209,7 @@ static void languageextension(LexState *ls, int isstatement, int islocal) {
         OutputBuffer_printf(&ls->output_buffer, " = ");
     }
 
-    OutputBuffer_printf(&ls->output_buffer, "_G.terra._trees[%d](", n);
+    OutputBuffer_printf(&ls->output_buffer, "_G.terra._trees.%s[%d](", ls->treeskey, n);
     print_captured_locals(ls, &tc);
     OutputBuffer_printf(&ls->output_buffer, ")");
     luaX_patchend(ls, &begin);
@@ -2190,6 +2263,20 @@ int luaY_parser(terra_State *T, ZIO *z, const char *name, int firstchar) {
     lexstate.terracnt = NULL;
     TString *tname = (name[0] == '@') ? luaS_new(T, name + 1)
                                       : luaS_stringf(T, "[string \"%s\"]", name);
+    // trees of this chunk are stored in _G.terra._trees[treeskey]. Chunks loaded from
+    // the module cache keep the keys they were saved with, which another process may
+    // also have produced, so keys that are already taken are skipped.
+    lua_getfield(L, LUA_GLOBALSINDEX, "terra");
+    lua_getfield(L, -1, "_trees");
+    for (;;) {
+        lexstate.treeskey = getstr(
+                luaS_stringf(T, "t%x_%x", T->numparses++, (unsigned)time(NULL)));
+        lua_getfield(L, -1, lexstate.treeskey);
+        bool taken = !lua_isnil(L, -1);
+        lua_pop(L, 1);
+        if (!taken) break;
+    }
+    lua_pop(L, 2);
     lexstate.buff = buff;
     lexstate.n_lua_objects = 0;
     lexstate.rethrow = 0;
@@ -2209,12 +2296,23 @@ int luaY_parser(terra_State *T, ZIO *z, const char *name, int firstchar) {
     lua_pushvalue(L, -1);
     luaX_globalset(&lexstate, TA_TERRA_OBJECT);
 
-    lua_getfield(L, to, "_trees");
+    lua_pushnil(L);  // created by store_value when the chunk has trees
     luaX_globalset(&lexstate, TA_FUNCTION_TABLE);
 
     lua_getfield(L, to, "irtypes");
     luaX_globalset(&lexstate, TA_TYPE_TABLE);
 
+    lua_createtable(L, NODE_SOURCE, 32);
+    lua_pushliteral(L, "linenumber");
+    lua_rawseti(L, -2, NODE_LINENUMBER);
+    lua_pushliteral(L, "offset");
+    lua_rawseti(L, -2, NODE_OFFSET);
+    lua_pushliteral(L, "filename");
+    lua_rawseti(L, -2, NODE_FILENAME);
+    lua_pushstring(L, getstr(tname));
+    lua_rawseti(L, -2, NODE_SOURCE);
+    luaX_globalset(&lexstate, TA_NODE_CACHE);
+
     lua_getfield(L, to, "newlist");
     luaX_globalset(&lexstate, TA_NEWLIST);
 
@@ -2267,6 +2365,12 @@ int luaY_parser(terra_State *T, ZIO *z, const char *name, int firstchar) {
 
     int err = luaL_loadbuffer(L, lexstate.output_buffer.data, lexstate.output_buffer.N,
                               name);
+    if (!err) {  // lets the module cache find the trees of the chunk it is saving
+        lua_getfield(L, LUA_GLOBALSINDEX, "terra");
+        lua_pushstring(L, lexstate.treeskey);
+        lua_setfield(L, -2, "_lasttreeskey");
+        lua_pop(L, 1);
+    }
     cleanup(&lexstate);
 
     return err;
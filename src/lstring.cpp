@@ -14,30 +14,168 @@
 #include "lstring.h"
 
 #include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <vector>
 
 
-TString *luaS_newlstr (terra_State *L, const char *str, size_t l) {
-    //get the tstring_table
-    lua_pushlightuserdata(L->L, &L->tstring_table);
-    lua_rawget(L->L, LUA_REGISTRYINDEX);
-    //look up the string
-    lua_pushlstring(L->L, str, l);
-    lua_pushvalue(L->L,-1);
-    lua_gettable(L->L, -3);
-    if(lua_isnil(L->L, -1)) {
-        lua_pop(L->L,1); //nil
-        TString * string = (TString *) lua_newuserdata(L->L, sizeof(TString));
-        string->string = luaL_checkstring(L->L, -2);
-        string->reserved = 0;
-        lua_rawset(L->L, -3);
-        lua_pop(L->L,1); //<table>
-        return string;
-    } else {
-        TString * string = (TString *) lua_touserdata(L->L, -1);
-        lua_pop(L->L,3); //<userdata> <string> <table>
-        return string;
+/*
+** Strings live in a chained hash table (like Lua's own string table)
+** whose nodes and characters are bump allocated from large chunks.
+** A parse opens a scope with luaS_pushscope; luaS_popscope unlinks every
+** string created since then and hands the chunks back, so TString pointers
+** are stable for exactly as long as the parse that created them.
+*/
+
+#define MINSTRTABSIZE 512
+#define CHUNKSIZE (64 * 1024)
+
+typedef struct TStringNode {
+    TString ts;
+    struct TStringNode *next;    /* next node in the hash chain */
+    struct TStringNode *before;  /* node created before this one */
+    size_t len;
+    unsigned int hash;
+    char data[1];
+} TStringNode;
+
+typedef struct StringChunk {
+    struct StringChunk *prev;
+    size_t size;
+} StringChunk;
+
+typedef struct StringScope {
+    TStringNode *last;
+    StringChunk *chunk;
+    size_t used;
+} StringScope;
+
+struct TStringTable {
+    TStringNode **hash;
+    size_t size; /* number of buckets, a power of 2 */
+    size_t nuse; /* number of strings */
+    TStringNode *last; /* most recently created string */
+    StringChunk *chunk; /* chunk currently being allocated from */
+    size_t used; /* bytes used in chunk, including its header */
+    std::vector<StringScope> scopes;
+};
+
+static unsigned int hashstring (const char *str, size_t l) {
+  unsigned int h = cast(unsigned int, l);
+  size_t step = (l>>5)+1;
+  size_t l1;
+  for (l1=l; l1>=step; l1-=step)
+    h = h ^ ((h<<5)+(h>>2)+cast_uchar(str[l1-1]));
+  return h;
+}
+
+static void *allocstring (TStringTable *tb, size_t n) {
+  n = (n + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+  if (tb->chunk == NULL || tb->used + n > tb->chunk->size) {
+    size_t size = sizeof(StringChunk) + n;
+    if (size < CHUNKSIZE) size = CHUNKSIZE;
+    StringChunk *c = (StringChunk *) malloc(size);
+    c->prev = tb->chunk;
+    c->size = size;
+    tb->chunk = c;
+    tb->used = sizeof(StringChunk);
+  }
+  void *r = (char *)tb->chunk + tb->used;
+  tb->used += n;
+  return r;
+}
+
+static void resize (TStringTable *tb, size_t newsize) {
+  TStringNode **newhash = (TStringNode **) calloc(newsize, sizeof(TStringNode *));
+  for (size_t i = 0; i < tb->size; i++) {
+    TStringNode *p = tb->hash[i];
+    while (p) {
+      TStringNode *next = p->next;
+      size_t h = p->hash & (newsize - 1);
+      p->next = newhash[h];
+      newhash[h] = p;
+      p = next;
     }
-    
+  }
+  free(tb->hash);
+  tb->hash = newhash;
+  tb->size = newsize;
+}
+
+void luaS_init (terra_State *L) {
+  TStringTable *tb = new TStringTable();
+  tb->hash = NULL;
+  tb->size = 0;
+  tb->nuse = 0;
+  tb->last = NULL;
+  tb->chunk = NULL;
+  tb->used = 0;
+  resize(tb, MINSTRTABSIZE);
+  L->strings = tb;
+}
+
+void luaS_free (terra_State *L) {
+  TStringTable *tb = L->strings;
+  if (!tb) return;
+  while (tb->chunk) {
+    StringChunk *prev = tb->chunk->prev;
+    free(tb->chunk);
+    tb->chunk = prev;
+  }
+  free(tb->hash);
+  delete tb;
+  L->strings = NULL;
+}
+
+void luaS_pushscope (terra_State *L) {
+  TStringTable *tb = L->strings;
+  StringScope s = { tb->last, tb->chunk, tb->used };
+  tb->scopes.push_back(s);
+}
+
+void luaS_popscope (terra_State *L) {
+  TStringTable *tb = L->strings;
+  assert(!tb->scopes.empty());
+  StringScope s = tb->scopes.back();
+  tb->scopes.pop_back();
+  for (TStringNode *n = tb->last; n != s.last; n = n->before) {
+    TStringNode **p = &tb->hash[n->hash & (tb->size - 1)];
+    while (*p != n) p = &(*p)->next;
+    *p = n->next;
+    tb->nuse--;
+  }
+  tb->last = s.last;
+  while (tb->chunk != s.chunk) {
+    StringChunk *prev = tb->chunk->prev;
+    free(tb->chunk);
+    tb->chunk = prev;
+  }
+  tb->used = s.used;
+}
+
+TString *luaS_newlstr (terra_State *L, const char *str, size_t l) {
+  TStringTable *tb = L->strings;
+  unsigned int h = hashstring(str, l);
+  for (TStringNode *n = tb->hash[h & (tb->size - 1)]; n != NULL; n = n->next) {
+    if (n->hash == h && n->len == l && memcmp(str, n->data, l) == 0)
+      return &n->ts;
+  }
+  if (tb->nuse >= tb->size)
+    resize(tb, tb->size * 2);
+  TStringNode *n = (TStringNode *) allocstring(tb, offsetof(TStringNode, data) + l + 1);
+  memcpy(n->data, str, l);
+  n->data[l] = '\0';
+  n->ts.string = n->data;
+  n->ts.reserved = 0;
+  n->len = l;
+  n->hash = h;
+  TStringNode **list = &tb->hash[h & (tb->size - 1)];
+  n->next = *list;
+  *list = n;
+  n->before = tb->last;
+  tb->last = n;
+  tb->nuse++;
+  return &n->ts;
 }
 
 
@@ -28,6 +28,11 @@
 */
 #define eqstr(a,b)  ((a) == (b))
 
+LUAI_FUNC void luaS_init (terra_State *L);
+LUAI_FUNC void luaS_free (terra_State *L);
+/* strings created after pushscope are forgotten by the matching popscope */
+LUAI_FUNC void luaS_pushscope (terra_State *L);
+LUAI_FUNC void luaS_popscope (terra_State *L);
 LUAI_FUNC TString *luaS_newlstr (terra_State *L, const char *str, size_t l);
 LUAI_FUNC TString *luaS_new (terra_State *L, const char *str);
 
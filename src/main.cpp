@@ -125,6 +125,7 @@ void usage() {
            "    -h print this help message\n"
            "    -i enter the REPL after processing source files\n"
            "    -m use LLVM's MCJIT\n"
+           "    -P write a perf map of JIT compiled functions, -PP also writes a jitdump\n"
            "    -e 'chunk' : execute command-line 'chunk' of code\n"
            "    -  Execute stdin instead of script and stop parsing options\n");
 }
@@ -138,10 +139,11 @@ void parse_args(lua_State *L, int argc, char **argv, terra_Options *options,
                                        {"interactive", 0, NULL, 'i'},
                                        {"mcjit", 0, NULL, 'm'},
                                        {"execute", required_argument, NULL, 'e'},
+                                       {"perf", 0, NULL, 'P'},
                                        {NULL, 0, NULL, 0}};
     /*  Parse commandline options  */
     opterr = 0;
-    while ((ch = getopt_long(argc, argv, "+hvgime:p:", longopts, NULL)) != -1) {
+    while ((ch = getopt_long(argc, argv, "+hvgimPe:p:", longopts, NULL)) != -1) {
         switch (ch) {
             case 'v':
                 options->verbose++;
@@ -155,6 +157,9 @@ void parse_args(lua_State *L, int argc, char **argv, terra_Options *options,
             case 'm':
                 options->usemcjit = 1;
                 break;
+            case 'P':
+                options->perf++;
+                break;
             case 'e':
                 options->cmd_line_chunk = (char *)malloc(strlen(optarg) + 1);
                 strcpy(options->cmd_line_chunk, optarg);
@@ -18,6 +18,7 @@ extern "C" {
 #undef interface
 #else
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #endif
 
@@ -36,12 +37,36 @@ extern "C" {
 #include "llvm/ExecutionEngine/OrcMCJITReplacement.h"
 #endif
 
+#if LLVM_VERSION == 32
+#include "llvm/MDBuilder.h"
+#include "llvm/Operator.h"
+#else
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Operator.h"
+#endif
+
 #include "llvm/Support/Atomic.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Memory.h"
+#include "llvm/Support/Process.h"
 #include "tllvmutil.h"
+#include "tperf.h"
+#if LLVM_VERSION > 40
+#include "llvm/DebugInfo/DWARF/DWARFContext.h"
+#else
+namespace llvm {
+class DIContext;
+}
+#endif
 
 using namespace llvm;
 
+#if LLVM_VERSION >= 36 && (defined(__x86_64__) || defined(_M_X64))
+#define TERRA_CAN_REDIRECT_FUNCTIONS
+// terra_redirectfunction overwrites a function's entry with movabs $to, %r11; jmp *%r11
+enum { RedirectSize = 13 };
+#endif
+
 #define TERRALIB_FUNCTIONS(_)                                                            \
     _(inittarget, 1)                                                                     \
     _(freetarget, 0)                                                                     \
@@ -52,6 +77,7 @@ using namespace llvm;
     _(freecompilationunit, 0)                                                            \
     _(jit, 1) /*entry point from lua into compiler to actually invoke the JIT by calling \
                  getPointerToFunction*/                                                  \
+    _(jitbatch, 1) /*like jit, for a list of values that are compiled together*/         \
     _(llvmsizeof, 1)                                                                     \
     _(disassemble, 1)                                                                    \
     _(pointertolightuserdata, 0) /*because luajit ffi doesn't do this...*/               \
@@ -62,7 +88,11 @@ using namespace llvm;
     _(linkllvmimpl, 1)                                                                   \
     _(currenttimeinseconds, 0)                                                           \
     _(isintegral, 0)                                                                     \
-    _(dumpmodule, 1)
+    _(dumpmodule, 1)                                                                     \
+    _(memoryreport, 1)                                                                   \
+    _(jitmemoryreport, 1)                                                                \
+    _(redirectfunction, 1)                                                               \
+    _(linkedfunctions, 1)
 
 #define DEF_LIBFUNCTION(nm, isclo) static int terra_##nm(lua_State *L);
 TERRALIB_FUNCTIONS(DEF_LIBFUNCTION)
@@ -100,7 +130,10 @@ struct DisassembleFunctionListener : public JITEventListener {
         DEBUG_ONLY(T) { fi.efd = EFD; }
     }
 #if LLVM_VERSION >= 34
-    void InitializeDebugData(StringRef name, object::SymbolRef::Type type, uint64_t sz) {
+    // dwarf, when present, holds the line tables of the object that defines the
+    // function at objaddr
+    void InitializeDebugData(StringRef name, object::SymbolRef::Type type, uint64_t sz,
+                             DIContext *dwarf = NULL, uint64_t objaddr = 0) {
         if (type == object::SymbolRef::ST_Function) {
 #if !defined(__arm__) && !defined(__linux__) && !defined(__FreeBSD__)
             name = name.substr(1);
@@ -109,13 +142,53 @@ struct DisassembleFunctionListener : public JITEventListener {
             if (addr) {
                 assert(addr);
                 TerraFunctionInfo &fi = T->C->functioninfo[addr];
+                // both the listener and the memory manager may report the same
+                // object when not running on the Orc replacement
+                bool isnew = fi.addr != addr || fi.name != name;
                 fi.ctx = CU->TT->ctx;
                 fi.name = name;
                 fi.addr = addr;
                 fi.size = sz;
+                if (isnew) fi.lines.clear();
+                // only the memory manager's report has the DWARF of the object
+                std::vector<PerfLineEntry> lines;
+                if (dwarf) ReadLineTable(dwarf, objaddr, addr, sz, &lines);
+                bool havelines = !fi.lines.empty();
+                for (size_t i = 0; !havelines && i < lines.size(); i++) {
+                    // the map's keys stay put, unlike fi when functioninfo grows
+                    StringRef file =
+                            T->C->linefiles.insert(std::make_pair(lines[i].file, 0))
+                                    .first->getKey();
+                    TerraLineStart ls = {(uintptr_t)lines[i].addr, lines[i].line, file};
+                    fi.lines.push_back(ls);
+                }
+                if (T->options.perf && isnew) WritePerfInfo(name, addr, sz, lines);
             }
         }
     }
+    // the line table of the function at objaddr in the object, relocated to addr
+    void ReadLineTable(DIContext *dwarf, uint64_t objaddr, void *addr, uint64_t sz,
+                       std::vector<PerfLineEntry> *lines) {
+#if LLVM_VERSION > 40
+        DILineInfoTable table = dwarf->getLineInfoForAddressRange(
+                objaddr, sz,
+                DILineInfoSpecifier(
+                        DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath));
+        for (size_t i = 0; i < table.size(); i++) {
+            if (table[i].second.Line == 0) continue;  // code not attributed to a line
+            PerfLineEntry e;
+            e.addr = (uint64_t)addr + (table[i].first - objaddr);
+            e.line = table[i].second.Line;
+            e.file = table[i].second.FileName;
+            lines->push_back(e);
+        }
+#endif
+    }
+    void WritePerfInfo(StringRef name, void *addr, uint64_t sz,
+                       const std::vector<PerfLineEntry> &lines) {
+        if (name.startswith("$")) name = name.substr(1);  // see FunctionEmitter
+        terra_perfwritefunction(T, name.str(), addr, sz, lines);
+    }
 #endif
 #if LLVM_VERSION >= 34 && LLVM_VERSION <= 35
     virtual void NotifyObjectEmitted(const ObjectImage &Obj) {
@@ -169,8 +242,30 @@ struct DisassembleFunctionListener : public JITEventListener {
 };
 
 #if LLVM_VERSION > 40
+static void *JITExternalSymbol(TerraTarget *TT, StringRef name);
+
+// a range of address space that sections are bump allocated from
+struct TerraMemoryRegion {
+    sys::MemoryBlock mapping;  // as returned by allocateMappedMemory, for releasing it
+    uintptr_t base, size, used;
+    uintptr_t protectedend;          // [base, protectedend) is no longer writable
+    uintptr_t dirtybegin, dirtyend;  // written since the last finalization, or empty
+};
+
+// Instead of mapping pages for each object as SectionMemoryManager does, the sections of
+// all objects of a compilation unit are bump allocated from large regions, one list of
+// regions for each kind of section. Code compiled at different times is then packed
+// into few pages and iTLB entries. Protections are changed once per region and
+// finalization, over the whole range written since the last one.
+// By default code of a new object starts on a page of its own, so finalized code is
+// never made writable again. With CU->compactcode, or CU->hugepages (which needs the
+// whole 2MB region to keep one protection), code shares pages with finalized code, and
+// those pages are not executable while an object is being loaded.
 class TerraSectionMemoryManager : public SectionMemoryManager {
 public:
+    enum Kind { Code, ROData, RWData, NKINDS };
+    enum { RegionSize = 2 << 20 };  // also the size of a huge page
+
 #if LLVM_VERSION > 50
     TerraSectionMemoryManager(TerraCompilationUnit *CU_in, MemoryMapper *MM = nullptr)
             : SectionMemoryManager(MM) {
@@ -178,27 +273,184 @@ public:
     TerraSectionMemoryManager(TerraCompilationUnit *CU_in) : SectionMemoryManager() {
 #endif
         CU = CU_in;
+        CU->memorymanager = this;
+        protections = 0;
+        for (int k = 0; k < NKINDS; k++) allocated[k] = 0;
+    }
+    ~TerraSectionMemoryManager() {
+        CU->memorymanager = NULL;
+        for (int k = 0; k < NKINDS; k++)
+            for (size_t i = 0; i < regions[k].size(); i++)
+                sys::Memory::releaseMappedMemory(regions[k][i].mapping);
     }
 
     TerraSectionMemoryManager(const TerraSectionMemoryManager &) = delete;
     void operator=(const TerraSectionMemoryManager &) = delete;
 
+    uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment, unsigned SectionID,
+                                 StringRef SectionName) override {
+        return allocate(Code, Size, Alignment);
+    }
+    uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID,
+                                 StringRef SectionName, bool IsReadOnly) override {
+        return allocate(IsReadOnly ? ROData : RWData, Size, Alignment);
+    }
+    bool finalizeMemory(std::string *ErrMsg) override {
+        uintptr_t pagesize = sys::Process::getPageSize();
+        for (int k = Code; k <= ROData; k++) {
+            for (size_t i = 0; i < regions[k].size(); i++) {
+                TerraMemoryRegion &R = regions[k][i];
+                if (R.dirtyend == 0) continue;
+                uintptr_t begin = R.dirtybegin & ~(pagesize - 1);
+                uintptr_t end = (R.dirtyend + pagesize - 1) & ~(pagesize - 1);
+                if (wholeregion(Kind(k))) begin = R.base, end = R.base + R.size;
+                // read-only data is left executable, as SectionMemoryManager does
+                if (!protect(begin, end, sys::Memory::MF_READ | sys::Memory::MF_EXEC)) {
+                    if (ErrMsg) *ErrMsg = "cannot protect JIT memory";
+                    return true;
+                }
+                if (k == Code)
+                    sys::Memory::InvalidateInstructionCache((void *)R.dirtybegin,
+                                                            R.dirtyend - R.dirtybegin);
+                R.protectedend = end;
+                R.dirtybegin = R.dirtyend = 0;
+                if (k == Code && !compact()) R.used = end - R.base;
+            }
+        }
+        return false;
+    }
+    // fills a table with, for each kind of section, how much address space is
+    // reserved, how much of it the bump pointers have passed, and how much of that was
+    // requested by sections; the difference is padding and page rounding
+    void pushReport(lua_State *L) {
+        static const char *names[] = {"code", "rodata", "rwdata"};
+        lua_newtable(L);
+        for (int k = 0; k < NKINDS; k++) {
+            uintptr_t reserved = 0, used = 0;
+            for (size_t i = 0; i < regions[k].size(); i++) {
+                reserved += regions[k][i].size;
+                used += regions[k][i].used;
+            }
+            lua_newtable(L);
+            lua_pushnumber(L, regions[k].size());
+            lua_setfield(L, -2, "regions");
+            lua_pushnumber(L, reserved);
+            lua_setfield(L, -2, "reserved");
+            lua_pushnumber(L, used);
+            lua_setfield(L, -2, "used");
+            lua_pushnumber(L, allocated[k]);
+            lua_setfield(L, -2, "allocated");
+            lua_setfield(L, -2, names[k]);
+        }
+        lua_pushnumber(L, protections);
+        lua_setfield(L, -2, "protections");
+    }
+
     void notifyObjectLoaded(ExecutionEngine *EE, const object::ObjectFile &obj) override {
+        std::unique_ptr<DIContext> dwarf;
+        // line tables are used by the jitdump, and by stack traces and the profiler
+        // in debug mode
+        if (CU->T->options.perf > 1 || CU->T->options.debug)
+#if LLVM_VERSION >= 60
+            dwarf = DWARFContext::create(obj);
+#else
+            dwarf.reset(new DWARFContextInMemory(obj));
+#endif
         auto size_map = llvm::object::computeSymbolSizes(obj);
         for (auto &S : size_map) {
             object::SymbolRef sym = S.first;
             auto name = sym.getName();
             auto type = sym.getType();
+            auto objaddr = sym.getAddress();
             // printf("notify: %s %d %#010llx\n", cantFail(std::move(name)).data(),
             // cantFail(std::move(type)), S.second);
-            if (name && type)
+            if (name && type && objaddr)
                 static_cast<DisassembleFunctionListener *>(CU->jiteventlistener)
-                        ->InitializeDebugData(name.get(), type.get(), S.second);
+                        ->InitializeDebugData(name.get(), type.get(), S.second,
+                                              dwarf.get(), objaddr.get());
         }
     }
 
+    // C functions that were not copied into the compilation unit are resolved against
+    // the code compiled once for the target before looking in the process
+    uint64_t getSymbolAddress(const std::string &Name) override {
+        StringRef name = Name;
+        char prefix = CU->getDataLayout().getGlobalPrefix();
+        if (prefix && name.size() > 0 && name[0] == prefix) name = name.substr(1);
+        if (void *addr = JITExternalSymbol(CU->TT, name)) return (uint64_t)addr;
+        return SectionMemoryManager::getSymbolAddress(Name);
+    }
+
 private:
+    bool compact() { return CU->compactcode || CU->hugepages; }
+    bool wholeregion(Kind k) { return k == Code && CU->hugepages; }
+    bool protect(uintptr_t begin, uintptr_t end, unsigned flags) {
+        protections++;
+        sys::MemoryBlock block((void *)begin, end - begin);
+        return !sys::Memory::protectMappedMemory(block, flags);
+    }
+    TerraMemoryRegion *newRegion(Kind k, uintptr_t minsize) {
+        uintptr_t pagesize = sys::Process::getPageSize();
+        uintptr_t alignment = pagesize;
+        if (k == Code && CU->hugepages) alignment = RegionSize;
+        uintptr_t size = std::max((uintptr_t)RegionSize,
+                                  (minsize + alignment - 1) & ~(alignment - 1));
+        // keep the regions of a unit close together, because code refers to its data
+        // with 32-bit pc-relative offsets
+        sys::MemoryBlock near;
+        for (int j = 0; j < NKINDS; j++)
+            if (!regions[j].empty()) near = regions[j].back().mapping;
+        std::error_code ec;
+        sys::MemoryBlock mapping = sys::Memory::allocateMappedMemory(
+                size + alignment - pagesize, near.base() ? &near : NULL,
+                sys::Memory::MF_READ | sys::Memory::MF_WRITE, ec);
+        if (ec) return NULL;
+        TerraMemoryRegion R;
+        R.mapping = mapping;
+        R.base = ((uintptr_t)mapping.base() + alignment - 1) & ~(alignment - 1);
+        R.size = size;
+        R.used = 0;
+        R.protectedend = R.base;
+        R.dirtybegin = R.dirtyend = 0;
+#ifdef MADV_HUGEPAGE
+        if (alignment == RegionSize) madvise((void *)R.base, R.size, MADV_HUGEPAGE);
+#endif
+        regions[k].push_back(R);
+        return &regions[k].back();
+    }
+    uint8_t *allocate(Kind k, uintptr_t size, unsigned alignment) {
+        if (alignment == 0) alignment = 16;
+        TerraMemoryRegion *R = regions[k].empty() ? NULL : &regions[k].back();
+        uintptr_t start = 0;
+        if (R) start = (R->base + R->used + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        if (!R || start + size > R->base + R->size) {
+            // the rest of the current region is left unused
+            R = newRegion(k, size + alignment);
+            if (!R) return NULL;
+            start = (R->base + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        }
+        uintptr_t pagesize = sys::Process::getPageSize();
+        uintptr_t page = start & ~(pagesize - 1);
+        if (page < R->protectedend) {  // shares pages with a finalized object
+            uintptr_t begin = wholeregion(k) ? R->base : page;
+            if (!protect(begin, R->protectedend,
+                         sys::Memory::MF_READ | sys::Memory::MF_WRITE))
+                return NULL;
+            R->protectedend = begin;
+        }
+        if (k != RWData) {
+            if (R->dirtyend == 0) R->dirtybegin = start;
+            R->dirtyend = start + size;
+        }
+        R->used = start + size - R->base;
+        allocated[k] += size;
+        return (uint8_t *)start;
+    }
+
     TerraCompilationUnit *CU;
+    std::vector<TerraMemoryRegion> regions[NKINDS];
+    uintptr_t allocated[NKINDS];  // bytes requested by sections
+    size_t protections;           // number of protection changes
 };
 #endif
 
@@ -260,15 +512,17 @@ static void RegisterFunction(struct terra_State *T, const char *name, int isclo,
 
 static llvm::sys::Mutex terrainitlock;
 static int terrainitcount;
-bool OneTimeInit(struct terra_State *T) {
-    bool success = true;
+static bool terratargetsinitialized;
+// registering every LLVM target is a large part of startup, so it is done when the
+// first target is created rather than in terra_init
+static void InitializeTargets() {
 #if LLVM_VERSION <= 35
     terrainitlock.acquire();
 #else
     terrainitlock.lock();
 #endif
-    terrainitcount++;
-    if (terrainitcount == 1) {
+    if (!terratargetsinitialized) {
+        terratargetsinitialized = true;
 #ifdef PRINT_LLVM_TIMING_STATS
         AddLLVMOptions(1, "-time-passes");
 #endif
@@ -280,7 +534,22 @@ bool OneTimeInit(struct terra_State *T) {
         InitializeAllAsmPrinters();
         InitializeAllAsmParsers();
         InitializeAllTargetMCs();
-    } else {
+    }
+#if LLVM_VERSION <= 35
+    terrainitlock.release();
+#else
+    terrainitlock.unlock();
+#endif
+}
+bool OneTimeInit(struct terra_State *T) {
+    bool success = true;
+#if LLVM_VERSION <= 35
+    terrainitlock.acquire();
+#else
+    terrainitlock.lock();
+#endif
+    terrainitcount++;
+    if (terrainitcount > 1) {
 #if LLVM_VERSION <= 34
         if (!llvm_is_multithreaded()) {
             if (!llvm_start_multithreaded()) {
@@ -307,6 +576,7 @@ bool HostHasAVX() {
 
 int terra_inittarget(lua_State *L) {
     terra_State *T = terra_getstate(L, 1);
+    InitializeTargets();
     TerraTarget *TT = new TerraTarget();
     TT->id = T->targets.size();
     T->targets.push_back(TT);
@@ -414,15 +684,29 @@ int terra_initcompilationunit(lua_State *L) {
     CU->M->setDataLayout(TT->tm->getDataLayout());
 #endif
 
-    CU->mi = new ManualInliner(TT->tm, CU->M);
-    CU->fpm = new FunctionPassManagerT(CU->M);
-    llvmutil_addtargetspecificpasses(CU->fpm, TT->tm);
-    llvmutil_addoptimizationpasses(CU->fpm);
-    CU->fpm->doInitialization();
+    // the pass managers are created when the first function is compiled, see
+    // InitializePasses
     lua_pushlightuserdata(L, CU);
     return 1;
 }
 
+// there is one function pipeline for each optimization level used in the unit
+static llvmutil_FunctionOptimizer *GetFunctionPasses(TerraCompilationUnit *CU,
+                                                     llvmutil_OptLevel level) {
+    if (!CU->fpm[level])
+        CU->fpm[level] = llvmutil_createfunctionoptimizer(CU->TT->tm, CU->M, level);
+    return CU->fpm[level];
+}
+// the inliner runs on the module when it is created, so this must happen before any
+// function is emitted into it. Its threshold comes from the level of the unit at that
+// point.
+static void InitializePasses(TerraCompilationUnit *CU) {
+    if (CU->mi) return;
+    unsigned sizelevel = (CU->optlevel == llvmutil_Os) ? 1 : 0;
+    unsigned optlevel = sizelevel ? 2 : CU->optlevel;
+    CU->mi = new ManualInliner(CU->TT->tm, CU->M, optlevel, sizelevel);
+}
+
 static void InitializeJIT(TerraCompilationUnit *CU) {
     if (CU->ee) return;  // already initialized
     Module *topeemodule =
@@ -454,7 +738,9 @@ static void InitializeJIT(TerraCompilationUnit *CU) {
 #else
             .setOptLevel(CodeGenOpt::Aggressive)
             .setMCJITMemoryManager(make_unique<TerraSectionMemoryManager>(CU))
-            .setUseOrcMCJITReplacement(true);
+            // the Orc replacement does not notify JIT event listeners, which the
+            // debugger registration below relies on
+            .setUseOrcMCJITReplacement(CU->T->options.debug <= 1);
 #endif
 
     CU->ee = eb.create();
@@ -462,6 +748,15 @@ static void InitializeJIT(TerraCompilationUnit *CU) {
     CU->jiteventlistener = new DisassembleFunctionListener(CU);
 #if LLVM_VERSION < 50
     CU->ee->RegisterJITEventListener(CU->jiteventlistener);
+#else
+    if (CU->T->options.debug > 1) CU->ee->RegisterJITEventListener(CU->jiteventlistener);
+#endif
+#if LLVM_VERSION >= 35
+    if (CU->T->options.debug > 1) {
+        // make JIT objects and their DWARF visible to gdb and lldb through the
+        // __jit_debug_register_code interface, the listener is a shared singleton
+        CU->ee->RegisterJITEventListener(JITEventListener::createGDBRegistrationListener());
+    }
 #endif
 }
 
@@ -478,8 +773,7 @@ int terra_compilerinit(struct terra_State *T) {
 
     lua_pop(T->L, 1);  // remove terra from stack
 
-    T->C = new terra_CompilerState();
-    memset(T->C, 0, sizeof(terra_CompilerState));
+    T->C = new terra_CompilerState();  // value-initialized, the members are zero or empty
     T->C->nreferences = 1;
 #ifndef TERRA_CAN_USE_OLD_JIT
     T->options.usemcjit = 1;  // force mcjit use, since old JIT is no longer supported.
@@ -495,7 +789,9 @@ int terra_compilerinit(struct terra_State *T) {
 void freetarget(TerraTarget *TT) {
     assert(TT->nreferences > 0);
     if (0 == --TT->nreferences) {
+        delete TT->externalee;  // owns the modules extracted from external
         delete TT->external;
+        for (size_t i = 0; i < TT->lazyexternals.size(); i++) delete TT->lazyexternals[i];
         delete TT->tm;
         delete TT->ctx;
         delete TT;
@@ -506,11 +802,18 @@ int terra_freetarget(lua_State *L) {
     return 0;
 }
 
+static void FreeTypes(TerraCompilationUnit *CU);
+
 static void freecompilationunit(TerraCompilationUnit *CU) {
     assert(CU->nreferences > 0);
     if (0 == --CU->nreferences) {
+        FreeTypes(CU);
+#if LLVM_VERSION >= 50
+        delete CU->dibuilder;
+#endif
         delete CU->mi;
-        delete CU->fpm;
+        for (int i = 0; i < llvmutil_NOPTLEVELS; i++)
+            if (CU->fpm[i]) llvmutil_freefunctionoptimizer(CU->fpm[i]);
         if (CU->ee) {
             CU->ee->UnregisterJITEventListener(CU->jiteventlistener);
             delete CU->jiteventlistener;
@@ -559,6 +862,10 @@ struct TType {  // contains llvm raw type pointer and any metadata about it we n
 class Types {
     TerraCompilationUnit *CU;
     terra_State *T;
+    // keyed on the address of the Terra type object. LookupTypeCache keeps the object
+    // alive in CU->types, a strong table owned by the CU (symbols is weak), so that
+    // its address cannot be reused by another type while the cache is alive
+    DenseMap<const void *, TType *> cache;
     TType *GetIncomplete(Obj *typ) {
         TType *t = NULL;
         if (!LookupTypeCache(typ, &t)) {
@@ -644,15 +951,13 @@ class Types {
     }
     Type *FunctionPointerType() { return Type::getInt8PtrTy(*CU->TT->ctx); }
     bool LookupTypeCache(Obj *typ, TType **t) {
-        *t = (TType *)CU->symbols->getud(typ);  // try to look up the cached type
+        typ->push();
+        TType *&entry = cache[lua_topointer(T->L, -1)];
+        lua_pop(T->L, 1);
+        *t = entry;
         if (*t == NULL) {
-            CU->symbols->push();
-            typ->push();
-            *t = (TType *)lua_newuserdata(T->L, sizeof(TType));
-            lua_settable(T->L, -3);
-            lua_pop(T->L, 1);
-            memset(*t, 0, sizeof(TType));
-            assert(*t != NULL);
+            *t = entry = new TType();
+            CU->types->setud(typ, *t);
             return false;
         }
         return true;
@@ -750,6 +1055,12 @@ class Types {
 
 public:
     Types(TerraCompilationUnit *CU_) : CU(CU_), T(CU_->T) {}
+    ~Types() {
+        for (DenseMap<const void *, TType *>::iterator it = cache.begin(),
+                                                        end = cache.end();
+             it != end; ++it)
+            delete it->second;
+    }
     TType *Get(Obj *typ) {
         assert(typ->kind("kind") != T_functype);  // Get should not be called on function
                                                   // directly, only function pointers
@@ -863,6 +1174,15 @@ struct CCallingConv {
         std::vector<Argument> paramtypes;
         FunctionType *fntype;
     };
+    // keyed like Types::cache, on the address of the function type object
+    DenseMap<const void *, Classification *> classifications;
+    ~CCallingConv() {
+        for (DenseMap<const void *, Classification *>::iterator
+                     it = classifications.begin(),
+                     end = classifications.end();
+             it != end; ++it)
+            delete it->second;
+    }
 
     RegisterClass Meet(RegisterClass a, RegisterClass b) { return (a > b) ? a : b; }
 
@@ -1010,13 +1330,17 @@ struct CCallingConv {
     }
 
     Classification *ClassifyFunction(Obj *fntyp) {
-        Classification *info = (Classification *)CU->symbols->getud(fntyp);
+        fntyp->push();
+        const void *key = lua_topointer(L, -1);
+        lua_pop(L, 1);
+        Classification *info = classifications.lookup(key);
         if (!info) {
-            info = new Classification();  // TODO: fix leak
+            info = new Classification();
             Obj params;
             fntyp->obj("parameters", &params);
             Classify(fntyp, &params, info);
-            CU->symbols->setud(fntyp, info);
+            classifications[key] = info;
+            CU->types->setud(fntyp, info);  // anchor fntyp, see Types::LookupTypeCache
         }
         return info;
     }
@@ -1034,6 +1358,25 @@ struct CCallingConv {
 #endif
     }
     template <typename FnOrCall>
+    void addNoAliasAttr(FnOrCall *r, int idx) {
+#if LLVM_VERSION == 32
+        AttrBuilder builder;
+        builder.addAttribute(Attributes::NoAlias);
+        r->addAttribute(idx, Attributes::get(*C->ctx, builder));
+#else
+        r->addAttribute(idx, Attribute::NoAlias);
+#endif
+    }
+    // mark the (pointer) parameter at position param of a C ABI function noalias
+    void AddNoAliasParameter(Function *fn, Obj *ftype, int param) {
+        Classification *info = ClassifyFunction(ftype);
+        assert(info->paramtypes[param].kind == C_PRIMITIVE);
+        int argidx = (info->returntype.kind == C_AGGREGATE_MEM) ? 2 : 1;
+        for (int i = 0; i < param; i++)
+            argidx += info->paramtypes[i].GetNumberOfTypesInParamList();
+        addNoAliasAttr(fn, argidx);
+    }
+    template <typename FnOrCall>
     void addByValAttr(FnOrCall *r, int idx) {
 #if LLVM_VERSION == 32
         AttrBuilder builder;
@@ -1101,6 +1444,52 @@ struct CCallingConv {
             return (B->CreateStore(src, addr_dst));
     }
 
+    // Terra-to-Terra calls use an internal fastcc variant of a function when the C ABI
+    // would coerce its small aggregate arguments or return value through memory or
+    // integer registers; the variant takes and returns them as first class values
+    bool IsSmallAggregate(TType *t) {
+        return CU->getDataLayout().getTypeAllocSize(t->type) <= 32;
+    }
+    bool UsesInternalConvention(Obj *ftype) {
+        if (ftype->boolean("isvararg") || StringRef(CU->TT->Triple).startswith("nvptx"))
+            return false;
+        Classification *info = ClassifyFunction(ftype);
+        bool coerced = false;
+        for (size_t i = 0; i < info->paramtypes.size(); i++) {
+            Argument *a = &info->paramtypes[i];
+            if (a->kind == C_PRIMITIVE) continue;
+            if (!IsSmallAggregate(a->type)) return false;
+            coerced = true;
+        }
+        Argument *rt = &info->returntype;
+        if (rt->kind == C_AGGREGATE_MEM ||
+            (rt->kind == C_AGGREGATE_REG && rt->GetNumberOfTypesInParamList() > 0)) {
+            if (!IsSmallAggregate(rt->type)) return false;
+            coerced = true;
+        }
+        return coerced;
+    }
+    Function *CreateInternalFunction(Module *M, Obj *ftype, const Twine &name) {
+        Classification *info = ClassifyFunction(ftype);
+        std::vector<Type *> arguments;
+        for (size_t i = 0; i < info->paramtypes.size(); i++)
+            arguments.push_back(info->paramtypes[i].type->type);
+        Argument *rt = &info->returntype;
+        bool isunit =
+                rt->kind == C_AGGREGATE_REG && rt->GetNumberOfTypesInParamList() == 0;
+        Type *returntype = isunit ? Type::getVoidTy(*CU->TT->ctx) : rt->type->type;
+        Function *fn = Function::Create(FunctionType::get(returntype, arguments, false),
+                                        Function::InternalLinkage, name, M);
+        fn->setCallingConv(CallingConv::Fast);
+#if LLVM_VERSION > 32 && defined(__arm__)
+        fn->addAttribute(llvm::AttributeSet::FunctionIndex, llvm::Attribute::NoUnwind);
+#endif
+#if LLVM_VERSION >= 37
+        DEBUG_ONLY(T) { fn->addFnAttr("no-frame-pointer-elim", "true"); }
+#endif
+        return fn;
+    }
+
     Function *CreateFunction(Module *M, Obj *ftype, const Twine &name) {
         Classification *info = ClassifyFunction(ftype);
         Function *fn = Function::Create(info->fntype, Function::InternalLinkage, name, M);
@@ -1292,8 +1681,78 @@ struct CCallingConv {
     }
 };
 
+// the type and calling convention caches live as long as the compilation unit so that
+// later compilations do not lay out or classify the same types again
+static void InitializeTypes(TerraCompilationUnit *CU) {
+    if (CU->Ty) return;
+    CU->Ty = new Types(CU);
+    CU->CC = new CCallingConv(CU, CU->Ty);
+}
+static void FreeTypes(TerraCompilationUnit *CU) {
+    delete CU->CC;
+    delete CU->Ty;
+}
+
 static Constant *EmitConstantInitializer(TerraCompilationUnit *CU, Obj *v);
 
+// build the typed LLVM constant for the value of type t stored at data (in the
+// target's layout), so that aggregates are visible to the optimizer field by field
+static Constant *EmitConstantFromMemory(TerraCompilationUnit *CU, Type *t,
+                                        const char *data) {
+    const DataLayout &DL = CU->getDataLayout();
+    if (t->isIntegerTy()) {
+        uint64_t integer = 0;
+        memcpy(&integer, data, DL.getTypeStoreSize(t));  // note: assuming little endian
+        return ConstantInt::get(t, integer);
+    } else if (t->isFloatTy() || t->isDoubleTy()) {
+        // built from the bits rather than from a double, which could change the
+        // payload of a NaN
+        uint64_t bits = 0;
+        memcpy(&bits, data, DL.getTypeStoreSize(t));  // note: assuming little endian
+#if LLVM_VERSION >= 40
+        const fltSemantics &sem =
+                t->isFloatTy() ? APFloat::IEEEsingle() : APFloat::IEEEdouble();
+#else
+        const fltSemantics &sem = t->isFloatTy() ? APFloat::IEEEsingle : APFloat::IEEEdouble;
+#endif
+        APInt value(t->getPrimitiveSizeInBits(), bits);
+        return ConstantFP::get(t->getContext(), APFloat(sem, value));
+    } else if (PointerType *pt = dyn_cast<PointerType>(t)) {
+        intptr_t address;
+        memcpy(&address, data, sizeof(address));
+        if (address == 0) return ConstantPointerNull::get(pt);
+        Constant *ptrint = ConstantInt::get(DL.getIntPtrType(*CU->TT->ctx), address);
+        return ConstantExpr::getIntToPtr(ptrint, pt);
+    } else if (StructType *st = dyn_cast<StructType>(t)) {
+        const StructLayout *layout = DL.getStructLayout(st);
+        std::vector<Constant *> elements;
+        for (unsigned i = 0; i < st->getNumElements(); i++) {
+            elements.push_back(EmitConstantFromMemory(
+                    CU, st->getElementType(i), data + layout->getElementOffset(i)));
+        }
+        return ConstantStruct::get(st, elements);
+    } else if (ArrayType *at = dyn_cast<ArrayType>(t)) {
+        Type *et = at->getElementType();
+        size_t stride = DL.getTypeAllocSize(et);
+        std::vector<Constant *> elements;
+        for (uint64_t i = 0; i < at->getNumElements(); i++) {
+            elements.push_back(EmitConstantFromMemory(CU, et, data + i * stride));
+        }
+        return ConstantArray::get(at, elements);
+    } else if (VectorType *vt = dyn_cast<VectorType>(t)) {
+        Type *et = vt->getElementType();
+        size_t stride = DL.getTypeAllocSize(et);
+        std::vector<Constant *> elements;
+        for (unsigned i = 0; i < vt->getNumElements(); i++) {
+            elements.push_back(EmitConstantFromMemory(CU, et, data + i * stride));
+        }
+        return ConstantVector::get(elements);
+    }
+    TERRA_DUMP_TYPE(t);
+    assert(!"NYI - constant load\n");
+    return NULL;
+}
+
 static GlobalVariable *CreateGlobalVariable(TerraCompilationUnit *CU, Obj *global,
                                             const char *name) {
     Obj t;
@@ -1316,6 +1775,51 @@ static GlobalVariable *CreateGlobalVariable(TerraCompilationUnit *CU, Obj *globa
 }
 
 static bool AlwaysShouldCopy(GlobalValue *G, void *data) { return true; }
+#if LLVM_VERSION > 40
+// externally visible C definitions are compiled once per target (see JITExternalSymbol),
+// so compilation units only take copies of the bodies they may want to inline
+static bool ShouldCopyExternalBody(GlobalValue *G, void *data) {
+    if (!G->hasExternalLinkage()) return true;
+    if (Function *fn = dyn_cast<Function>(G))
+        return fn->hasFnAttribute(Attribute::AlwaysInline) ||
+               fn->hasFnAttribute(Attribute::InlineHint);
+    return false;
+}
+#else
+#define ShouldCopyExternalBody AlwaysShouldCopy
+#endif
+
+// find the definition of an extern symbol in C code registered with includec or
+// linkllvm, returning the module that holds it in src. Definitions from lazily loaded
+// bitcode are read together with what they refer to; if that fails, NULL is returned
+// and errmsg is set
+static GlobalValue *LookupExternal(TerraTarget *TT, StringRef name, bool isfunction,
+                                   Module **src, std::string *errmsg) {
+    *src = TT->external;
+    GlobalValue *gv = isfunction ? (GlobalValue *)TT->external->getFunction(name)
+                                 : (GlobalValue *)TT->external->getGlobalVariable(name);
+    if (gv && !gv->isDeclaration()) return gv;
+    for (size_t i = 0; i < TT->lazyexternals.size(); i++) {
+        Module *M = TT->lazyexternals[i];
+        GlobalValue *lgv = isfunction ? (GlobalValue *)M->getFunction(name)
+                                      : (GlobalValue *)M->getGlobalVariable(name);
+        if (lgv && !lgv->isDeclaration()) {
+            *src = M;
+            return llvmutil_materializereachable(lgv, errmsg) ? lgv : NULL;
+        }
+    }
+    return gv;
+}
+// LookupExternal for code being emitted, where errors are reported to Lua
+static GlobalValue *LookupExternal(TerraCompilationUnit *CU, StringRef name,
+                                   bool isfunction, Module **src) {
+    std::string err;
+    GlobalValue *gv = LookupExternal(CU->TT, name, isfunction, src, &err);
+    if (!gv && !err.empty())
+        terra_reporterror(CU->T, "linkllvm: reading %s: %s\n", name.str().c_str(),
+                          err.c_str());
+    return gv;
+}
 
 static GlobalVariable *EmitGlobalVariable(TerraCompilationUnit *CU, Obj *global,
                                           const char *name) {
@@ -1327,10 +1831,11 @@ static GlobalVariable *EmitGlobalVariable(TerraCompilationUnit *CU, Obj *global,
         if (global->boolean("extern")) {
             gv = CU->M->getGlobalVariable(name);
             if (!gv) {
-                GlobalValue *externglobal = CU->TT->external->getGlobalVariable(name);
+                Module *src;
+                GlobalValue *externglobal = LookupExternal(CU, name, false, &src);
                 if (externglobal) {
-                    llvmutil_copyfrommodule(CU->M, CU->TT->external, &externglobal, 1,
-                                            AlwaysShouldCopy, NULL);
+                    llvmutil_copyfrommodule(CU->M, src, &externglobal, 1,
+                                            ShouldCopyExternalBody, NULL);
                     gv = CU->M->getGlobalVariable(name);
                     assert(gv);
                 }
@@ -1345,10 +1850,12 @@ static GlobalVariable *EmitGlobalVariable(TerraCompilationUnit *CU, Obj *global,
 const int COMPILATION_UNIT_POS = 1;
 static int terra_deletefunction(lua_State *L);
 
+TerraFunctionState *EmitFunctionState(TerraCompilationUnit *CU, Obj *funcobj,
+                                      TerraFunctionState *user);
 Function *EmitFunction(TerraCompilationUnit *CU, Obj *funcobj, TerraFunctionState *user);
 
 struct Locals {
-    Obj cur;
+    size_t mark;  // size of FunctionEmitter::shadowed when the scope was entered
     Locals *prev;
 };  // stack of local environment
 
@@ -1360,7 +1867,12 @@ struct FunctionEmitter {
     Types *Ty;
     CCallingConv *CC;
     Module *M;
-    Obj *labels, *labeldepth;
+    Obj *labeldepth;
+    DenseMap<int, BasicBlock *> labels;  // keyed on Label.id
+    // the variables in scope, keyed on Symbol.id; a variable that shadows another
+    // one records the old value in shadowed so that leaveScope can restore it
+    DenseMap<int, Value *> variables;
+    std::vector<std::pair<int, Value *> > shadowed;
     Locals *locals;
 
     IRBuilder<> *B;
@@ -1370,6 +1882,9 @@ struct FunctionEmitter {
 #ifdef DEBUG_INFO_WORKING
     DIBuilder *DB;
     DISubprogram SP;
+#elif LLVM_VERSION >= 50
+    DIBuilder *DB;
+    DISubprogram *SP;
 #endif
 
     StringMap<MDNode *> filenamecache;  // map from filename to lexical scope object
@@ -1379,9 +1894,9 @@ struct FunctionEmitter {
 
     Obj *funcobj;
     TerraFunctionState *fstate;
+    Function *body;  // the function being emitted, fstate->fastfunc if there is one
     std::vector<BasicBlock *> deferred;
 
-    Obj labeltbl;
     Locals basescope;
 
     FunctionEmitter(TerraCompilationUnit *CU_)
@@ -1395,7 +1910,6 @@ struct FunctionEmitter {
               locals(NULL) {
         B = new IRBuilder<>(*CU->TT->ctx);
         enterScope(&basescope);
-        labels = newMap(&labeltbl);
     }
     ~FunctionEmitter() { delete B; }
     TerraFunctionState *emitFunction(Obj *funcobj_) {
@@ -1412,10 +1926,11 @@ struct FunctionEmitter {
             if (isextern) {  // try to resolve function as imported C code
                 fstate->func = M->getFunction(name);
                 if (!fstate->func) {
-                    GlobalValue *externfunction = CU->TT->external->getFunction(name);
+                    Module *src;
+                    GlobalValue *externfunction = LookupExternal(CU, name, true, &src);
                     if (externfunction) {
-                        llvmutil_copyfrommodule(CU->M, CU->TT->external, &externfunction,
-                                                1, AlwaysShouldCopy, NULL);
+                        llvmutil_copyfrommodule(CU->M, src, &externfunction, 1,
+                                                ShouldCopyExternalBody, NULL);
                         fstate->func = CU->M->getFunction(name);
                         assert(fstate->func);
                     }
@@ -1432,25 +1947,86 @@ struct FunctionEmitter {
             if (isextern) {
                 // Set external linkage for extern functions.
                 fstate->func->setLinkage(GlobalValue::ExternalLinkage);
+            } else if (funcobj->boolean("redefinable")) {
+                // callers use the entry that terra_redirectfunction patches, rather
+                // than an internal variant that it would not
+#ifdef TERRA_CAN_REDIRECT_FUNCTIONS
+                fstate->func->addFnAttr("terra-redefinable");
+#endif
+            } else if (CC->UsesInternalConvention(&ftype)) {
+                fstate->fastfunc = CC->CreateInternalFunction(
+                        M, &ftype, Twine(fstate->func->getName(), ".fast"));
+                lua_pushboolean(L, true);  // see invalidate in terralib.lua
+                funcobj->setfield("internalentry");
             }
 
-            if (funcobj->hasfield("alwaysinline")) {
-                if (funcobj->boolean("alwaysinline")) {
-                    fstate->func->ADDFNATTR(AlwaysInline);
-                } else {
-                    fstate->func->ADDFNATTR(NoInline);
-                }
+            // a level given to the function itself also holds when saveobj optimizes
+            // the whole module, so it is recorded with function attributes too
+            bool ownlevel = funcobj->hasfield("optlevel");
+            fstate->optlevel = CU->optlevel;
+            if (ownlevel)
+                fstate->optlevel = llvmutil_parseoptlevel(funcobj->string("optlevel"));
+            if (funcobj->boolean("dontoptimize")) {
+                fstate->optlevel = llvmutil_O0;
+                ownlevel = true;
             }
-            if (funcobj->hasfield("dontoptimize")) {
-                if (funcobj->boolean("dontoptimize")) {
-                    fstate->func->ADDFNATTR(OptimizeNone);
-                    fstate->func->ADDFNATTR(NoInline);
+
+            Function *fns[] = {fstate->func, fstate->fastfunc};
+            for (size_t i = 0; i < 2 && fns[i]; i++) {
+                if (funcobj->hasfield("alwaysinline")) {
+                    if (funcobj->boolean("alwaysinline")) {
+                        fns[i]->ADDFNATTR(AlwaysInline);
+                    } else {
+                        fns[i]->ADDFNATTR(NoInline);
+                    }
+                }
+                if (ownlevel && fstate->optlevel == llvmutil_O0) {
+                    fns[i]->ADDFNATTR(OptimizeNone);
+                    fns[i]->ADDFNATTR(NoInline);
+                } else if (ownlevel && fstate->optlevel == llvmutil_Os) {
+                    fns[i]->ADDFNATTR(OptimizeForSize);
+                }
+                if (funcobj->hasfield("noreturn")) {
+                    if (funcobj->boolean("noreturn")) {
+                        fns[i]->ADDFNATTR(NoReturn);
+                    }
+                }
+                // LLVM has no hot attribute yet; an inline hint is the closest thing
+                if (funcobj->boolean("hot")) fns[i]->ADDFNATTR(InlineHint);
+#if LLVM_VERSION >= 34
+                if (funcobj->boolean("cold")) fns[i]->ADDFNATTR(Cold);
+#endif
+                if (funcobj->boolean("minsize")) {
+                    fns[i]->ADDFNATTR(MinSize);
+                    fns[i]->ADDFNATTR(OptimizeForSize);
                 }
+                if (funcobj->hasfield("align"))
+                    fns[i]->setAlignment(funcobj->number("align"));
+#if LLVM_VERSION >= 37
+                // read by the code generator, which creates a subtarget for each
+                // function. The features replace those of the target, so they are
+                // appended to them.
+                if (funcobj->hasfield("targetcpu"))
+                    fns[i]->addFnAttr("target-cpu", funcobj->string("targetcpu"));
+                if (funcobj->hasfield("targetfeatures")) {
+                    std::string features = CU->TT->Features;
+                    if (!features.empty()) features += ",";
+                    features += funcobj->string("targetfeatures");
+                    fns[i]->addFnAttr("target-features", features);
+                }
+#endif
             }
-            if (funcobj->hasfield("noreturn")) {
-                if (funcobj->boolean("noreturn")) {
-                    fstate->func->ADDFNATTR(NoReturn);
+            if (!isextern && funcobj->hasfield("noalias")) {
+                funcobj->pushfield("noalias");  // list of parameter positions
+                int N = lua_objlen(L, -1);
+                for (int i = 1; i <= N; i++) {
+                    lua_rawgeti(L, -1, i);
+                    int param = lua_tointeger(L, -1) - 1;
+                    lua_pop(L, 1);
+                    CC->AddNoAliasParameter(fstate->func, &ftype, param);
+                    if (fstate->fastfunc) CC->addNoAliasAttr(fstate->fastfunc, param + 1);
                 }
+                lua_pop(L, 1);
             }
 
             if (!isextern) {
@@ -1468,10 +2044,16 @@ struct FunctionEmitter {
                     VERBOSE_ONLY(T) { printf("optimizing scc containing: "); }
                     TerraFunctionState *f;
                     std::vector<Function *> scc;
+                    std::vector<llvmutil_OptLevel> levels;
                     do {
                         f = CU->tooptimize->back();
                         CU->tooptimize->pop_back();
                         scc.push_back(f->func);
+                        levels.push_back(f->optlevel);
+                        if (f->fastfunc) {
+                            scc.push_back(f->fastfunc);
+                            levels.push_back(f->optlevel);
+                        }
                         f->onstack = false;
                         VERBOSE_ONLY(T) {
                             std::string s = f->func->getName();
@@ -1480,11 +2062,13 @@ struct FunctionEmitter {
                     } while (fstate != f);
                     CU->mi->run(scc.begin(), scc.end());
                     for (size_t i = 0; i < scc.size(); i++) {
+                        if (levels[i] == llvmutil_O0) continue;
                         VERBOSE_ONLY(T) {
                             std::string s = scc[i]->getName();
                             printf("optimizing %s\n", s.c_str());
                         }
-                        CU->fpm->run(*scc[i]);
+                        llvmutil_FunctionOptimizer *FO = GetFunctionPasses(CU, levels[i]);
+                        llvmutil_optimizefunction(FO, scc[i]);
                         VERBOSE_ONLY(T) { TERRA_DUMP_FUNCTION(scc[i]); }
                     }
                 }
@@ -1514,13 +2098,16 @@ struct FunctionEmitter {
         fstate = &state;
         fstate->func = Function::Create(FunctionType::get(typeOfValue(exp)->type, false),
                                         Function::ExternalLinkage, "constant", M);
+        fstate->fastfunc = NULL;
+        body = fstate->func;
         BasicBlock *entry = BasicBlock::Create(*CU->TT->ctx, "entry", fstate->func);
         initDebug(exp->string("filename"), exp->number("linenumber"));
         setDebugPoint(exp);
         B->SetInsertPoint(entry);
         B->CreateRet(emitExp(exp));
         endDebug();
-        CU->fpm->run(*fstate->func);
+        // folding the expression needs the optimizer whatever the unit's level is
+        llvmutil_optimizefunction(GetFunctionPasses(CU, llvmutil_O3), fstate->func);
         ReturnInst *term =
                 cast<ReturnInst>(fstate->func->getEntryBlock().getTerminator());
         Constant *r = dyn_cast<Constant>(term->getReturnValue());
@@ -1528,13 +2115,9 @@ struct FunctionEmitter {
         fstate->func->eraseFromParent();
         return r;
     }
-    Obj *newMap(Obj *buf) {
-        lua_newtable(L);
-        CU->symbols->fromStack(buf);
-        return buf;
-    }
     void emitBody() {
-        BasicBlock *entry = BasicBlock::Create(*CU->TT->ctx, "entry", fstate->func);
+        body = fstate->fastfunc ? fstate->fastfunc : fstate->func;
+        BasicBlock *entry = BasicBlock::Create(*CU->TT->ctx, "entry", body);
         B->SetInsertPoint(entry);
 
         Obj parameters;
@@ -1549,7 +2132,13 @@ struct FunctionEmitter {
 
         std::vector<Value *> parametervars;
         emitExpressionList(&parameters, false, &parametervars);
-        CC->EmitEntry(B, &ftype, fstate->func, &parametervars);
+        if (fstate->fastfunc) {
+            Function::arg_iterator ai = body->arg_begin();
+            for (size_t i = 0; i < parametervars.size(); i++, ++ai)
+                B->CreateStore(&*ai, parametervars[i]);
+        } else {
+            CC->EmitEntry(B, &ftype, fstate->func, &parametervars);
+        }
 
         Obj body;
         funcobj->obj("body", &body);
@@ -1559,16 +2148,44 @@ struct FunctionEmitter {
         emitReturnUndef();
         assert(breakpoints.size() == 0);
 
-        VERBOSE_ONLY(T) { TERRA_DUMP_FUNCTION(fstate->func); }
-        verifyFunction(*fstate->func);
+        VERBOSE_ONLY(T) { TERRA_DUMP_FUNCTION(body); }
+        verifyFunction(*body);
 
         endDebug();
+        if (fstate->fastfunc) emitInternalWrapper(&ftype);
+    }
+    // the C ABI entry point of a function with an internal variant unpacks its
+    // arguments and forwards them; it is what function pointers and Lua call
+    void emitInternalWrapper(Obj *ftype) {
+        BasicBlock *entry = BasicBlock::Create(*CU->TT->ctx, "entry", fstate->func);
+        B->SetInsertPoint(entry);
+        B->SetCurrentDebugLocation(DebugLoc());
+        Obj parameters;
+        ftype->obj("parameters", &parameters);
+        std::vector<Value *> vars, arguments;
+        for (int i = 0; i < parameters.size(); i++) {
+            Obj p;
+            parameters.objAt(i, &p);
+            vars.push_back(CreateAlloca(B, getType(&p)->type));
+        }
+        CC->EmitEntry(B, ftype, fstate->func, &vars);
+        for (size_t i = 0; i < vars.size(); i++)
+            arguments.push_back(B->CreateLoad(vars[i]));
+        CallInst *call = B->CreateCall(fstate->fastfunc, arguments);
+        call->setCallingConv(CallingConv::Fast);
+        CC->EmitReturn(B, ftype, fstate->func, call);  // a void call is a unit result
+        VERBOSE_ONLY(T) { TERRA_DUMP_FUNCTION(fstate->func); }
+        verifyFunction(*fstate->func);
     }
     template <typename R>
     R *lookupSymbol(Obj *tbl, Obj *k) {
         return (R *)tbl->getud(k);
     }
-    void mapSymbol(Obj *tbl, Obj *k, void *v) { tbl->setud(k, v); }
+    void mapVariable(int id, Value *v) {
+        Value *&entry = variables[id];
+        shadowed.push_back(std::make_pair(id, entry));
+        entry = v;
+    }
     void mapFunction(Obj *tbl, Obj *k) {  // TerraFunctionState userdata is on top of
                                           // stack
         tbl->push();
@@ -1588,7 +2205,7 @@ struct FunctionEmitter {
         Obj sym;
         v->obj("symbol", &sym);
         AllocaInst *a = CreateAlloca(B, typeOfValue(v)->type, 0, v->string("name"));
-        mapSymbol(&locals->cur, &sym, a);
+        mapVariable(sym.number("id"), a);
         return a;
     }
 
@@ -1959,6 +2576,48 @@ struct FunctionEmitter {
         return addr;
     }
 
+    // with strictaliasing, scalar loads and stores get TBAA tags derived from their
+    // type as in C: integers of the same size share a type, all pointers share a type,
+    // and 8-bit accesses may alias anything. Accesses through a pointer cast in the same
+    // expression (union members, @[&T](p)) are left untagged.
+    void setTBAA(Instruction *access, Value *addr) {
+        if (!CU->strictaliasing || isa<BitCastOperator>(addr)) return;
+        Type *t = addr->getType()->getPointerElementType();
+        if (t->isPointerTy())
+            t = Type::getInt8PtrTy(*CU->TT->ctx);
+        else if (!t->isIntegerTy() && !t->isFloatingPointTy())
+            return;
+        MDNode *&tag = CU->tbaa[t];
+        if (!tag) {
+            MDBuilder mdb(*CU->TT->ctx);
+            if (!CU->tbaachar) {
+                MDNode *root = mdb.createTBAARoot("Terra TBAA");
+#if LLVM_VERSION >= 34
+                CU->tbaachar = mdb.createTBAAScalarTypeNode("omnipotent char", root);
+#else
+                CU->tbaachar = mdb.createTBAANode("omnipotent char", root);
+#endif
+            }
+            std::string name;
+            raw_string_ostream os(name);
+            t->print(os);
+            MDNode *node = CU->tbaachar;
+            if (!t->isIntegerTy(8)) {
+#if LLVM_VERSION >= 34
+                node = mdb.createTBAAScalarTypeNode(os.str(), CU->tbaachar);
+#else
+                node = mdb.createTBAANode(os.str(), CU->tbaachar);
+#endif
+            }
+#if LLVM_VERSION >= 34
+            tag = mdb.createTBAAStructTagNode(node, node, 0);
+#else
+            tag = node;
+#endif
+        }
+        access->setMetadata(LLVMContext::MD_tbaa, tag);
+    }
+
     Value *emitStore(Value *value, Value *addr, bool isVolatile, bool hasAlignment,
                      int alignment) {
         LoadInst *l = dyn_cast<LoadInst>(&*value);
@@ -1989,6 +2648,7 @@ struct FunctionEmitter {
         StoreInst *st = B->CreateStore(value, addr);
         if (isVolatile) st->setVolatile(true);
         if (hasAlignment) st->setAlignment(alignment);
+        setTBAA(st, addr);
         return st;
     }
 
@@ -2005,7 +2665,9 @@ struct FunctionEmitter {
             Obj type;
             exp->obj("type", &type);
             Ty->EnsureTypeIsComplete(&type);
-            raw = B->CreateLoad(raw);
+            LoadInst *l = B->CreateLoad(raw);
+            setTBAA(l, raw);
+            raw = l;
         }
         return raw;
     }
@@ -2016,10 +2678,7 @@ struct FunctionEmitter {
             case T_var: {
                 Obj sym;
                 exp->obj("symbol", &sym);
-                Value *v = NULL;
-                for (Locals *f = locals; v == NULL && f != NULL; f = f->prev) {
-                    v = lookupSymbol<Value>(&f->cur, &sym);
-                }
+                Value *v = variables.lookup(sym.number("id"));
                 assert(v);
                 return v;
             } break;
@@ -2140,19 +2799,16 @@ struct FunctionEmitter {
                     Obj objType;
                     type.obj("type", &objType);
                     if (t->type->getPointerElementType()->isIntegerTy(8)) {
-                        Obj stringvalue;
-                        exp->obj("value", &stringvalue);
-                        Value *str = lookupSymbol<Value>(CU->symbols, &stringvalue);
+                        exp->pushfield("value");
+                        size_t len;
+                        const char *rawstr = lua_tolstring(L, -1, &len);
+                        Value *&str = CU->strings[StringRef(rawstr, len)];
                         if (!str) {
-                            exp->pushfield("value");
-                            size_t len;
-                            const char *rawstr = lua_tolstring(L, -1, &len);
                             str = B->CreateGlobalString(
                                     StringRef(rawstr, len),
                                     "$string");  // needs a name to make mcjit work in 3.5
-                            lua_pop(L, 1);
-                            mapSymbol(CU->symbols, &stringvalue, str);
                         }
+                        lua_pop(L, 1);
                         return B->CreateBitCast(str, pt);
                     } else {
                         assert(!"NYI - pointer literal");
@@ -2163,33 +2819,24 @@ struct FunctionEmitter {
                 }
             } break;
             case T_constant: {
-                TType *typ = typeOfValue(exp);
-                Obj value;
+                Obj type;
+                exp->obj("type", &type);
+                Ty->EnsureTypeIsComplete(&type);
+                TType *typ = getType(&type);
                 exp->pushfield("value");
-                const void *data = lua_topointer(L, -1);
+                const char *data = (const char *)lua_topointer(L, -1);
                 assert(data);
-                size_t size = CU->getDataLayout().getTypeAllocSize(typ->type);
-                Value *r;
-                if (typ->type->isIntegerTy()) {
-                    uint64_t integer = 0;
-                    memcpy(&integer, data, size);  // note: assuming little endian, there
-                                                   // is probably a better way to do this
-                    r = ConstantInt::get(typ->type, integer);
-                } else if (typ->type->isFloatTy()) {
-                    r = ConstantFP::get(typ->type, *(const float *)data);
-                } else if (typ->type->isDoubleTy()) {
-                    r = ConstantFP::get(typ->type, *(const double *)data);
-                } else if (typ->type->isPointerTy()) {
-                    Constant *ptrint = ConstantInt::get(
-                            CU->getDataLayout().getIntPtrType(*CU->TT->ctx),
-                            *(const intptr_t *)data);
-                    r = ConstantExpr::getIntToPtr(ptrint, typ->type);
-                } else {
-                    TERRA_DUMP_TYPE(typ->type);
-                    assert(!"NYI - constant load\n");
-                }
+                Constant *r = EmitConstantFromMemory(CU, typ->type, data);
                 lua_pop(L, 1);  // remove pointer
-                return r;
+                if (!exp->boolean("lvalue")) return r;
+                // aggregate constants are addressable, so they live in a constant
+                // global that is shared by all uses of the same value
+                GlobalVariable *&gv = CU->aggregates[r];
+                if (!gv) {
+                    gv = new GlobalVariable(*M, typ->type, true,
+                                            GlobalValue::PrivateLinkage, r, "$constant");
+                }
+                return gv;
             } break;
             case T_apply: {
                 return emitCall(exp, false);
@@ -2324,7 +2971,9 @@ struct FunctionEmitter {
                 exp->obj("address", &addr);
                 exp->obj("attrs", &attr);
                 Ty->EnsureTypeIsComplete(&type);
-                LoadInst *l = B->CreateLoad(emitExp(&addr));
+                Value *addrexp = emitExp(&addr);
+                LoadInst *l = B->CreateLoad(addrexp);
+                setTBAA(l, addrexp);
                 if (attr.hasfield("alignment")) {
                     int alignment = attr.number("alignment");
                     l->setAlignment(alignment);
@@ -2380,7 +3029,7 @@ struct FunctionEmitter {
         return 0;
     }
     BasicBlock *createAndInsertBB(StringRef name) {
-        return BasicBlock::Create(*CU->TT->ctx, name, fstate->func);
+        return BasicBlock::Create(*CU->TT->ctx, name, body);
     }
     void followsBB(BasicBlock *b) { b->moveAfter(B->GetInsertBlock()); }
     Value *emitCond(Obj *cond) { return emitCond(emitExp(cond)); }
@@ -2454,7 +3103,7 @@ struct FunctionEmitter {
 #endif
                     fstate->func->getName(), fstate->func->getName(), file, lineno,
                     DB->createSubroutineType(file, TA), false, true, 0, 0, true,
-                    fstate->func);
+                    body);
 
             if (!M->getModuleFlagsMetadata()) {
                 M->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 2);
@@ -2478,6 +3127,72 @@ struct FunctionEmitter {
                     scope));
         }
     }
+#elif LLVM_VERSION >= 50
+    DIFile *createDebugInfoForFile(const char *filename) {
+        DIFile *&file = CU->difiles[filename];
+        if (file) return file;
+        // checking the existence of a file can be expensive, so only do it if debug
+        // mode is set to slow compile anyway.
+        if (T->options.debug > 1 && llvm::sys::fs::exists(filename)) {
+            SmallString<256> filepath = StringRef(filename);
+            llvm::sys::fs::make_absolute(filepath);
+            file = DB->createFile(llvm::sys::path::filename(filepath),
+                                  llvm::sys::path::parent_path(filepath));
+        } else {
+            file = DB->createFile(filename, ".");
+        }
+        return file;
+    }
+    MDNode *debugScopeForFile(const char *filename) {
+        StringMap<MDNode *>::iterator it = filenamecache.find(filename);
+        if (it != filenamecache.end()) return it->second;
+        MDNode *block = DB->createLexicalBlockFile(SP, createDebugInfoForFile(filename));
+        filenamecache[filename] = block;
+        return block;
+    }
+    void initDebug(const char *filename, int lineno) {
+        customfilename = NULL;
+        customlinenumber = 0;
+        DEBUG_ONLY(T) {
+            // one builder and compile unit for all functions of the module
+            if (!CU->dibuilder) CU->dibuilder = new DIBuilder(*M);
+            DB = CU->dibuilder;
+            DIFile *file = createDebugInfoForFile(filename);
+            if (!CU->dicompileunit)
+                CU->dicompileunit = DB->createCompileUnit(dwarf::DW_LANG_C99, file, "terra",
+                                                          CU->optimize, "", 0);
+            DISubroutineType *type =
+                    DB->createSubroutineType(DB->getOrCreateTypeArray(None));
+            StringRef name = fstate->func->getName();
+            SP = DB->createFunction(file, name.startswith("$") ? name.substr(1) : name,
+                                    name, file, lineno, type, false, true, lineno,
+                                    DINode::FlagPrototyped, CU->optimize);
+            body->setSubprogram(SP);
+            if (!M->getModuleFlag("Debug Info Version")) {
+                M->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+                M->addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                                 DEBUG_METADATA_VERSION);
+            }
+            filenamecache.clear();
+            filenamecache[filename] = SP;
+            B->SetCurrentDebugLocation(DebugLoc());
+        }
+    }
+    void endDebug() {
+        DEBUG_ONLY(T) {
+            DB->finalizeSubprogram(SP);
+            B->SetCurrentDebugLocation(DebugLoc());
+        }
+    }
+    void setDebugPoint(Obj *obj) {
+        DEBUG_ONLY(T) {
+            MDNode *scope = debugScopeForFile(customfilename ? customfilename
+                                                             : obj->string("filename"));
+            B->SetCurrentDebugLocation(DebugLoc::get(
+                    customfilename ? customlinenumber : obj->number("linenumber"), 0,
+                    scope));
+        }
+    }
 #else
     void initDebug(const char *filename, int lineno) {}
     void endDebug() {}
@@ -2493,10 +3208,9 @@ struct FunctionEmitter {
         Obj ident, lbl;
         stmt->obj("label", &ident);
         ident.obj("value", &lbl);
-        BasicBlock *bb = lookupSymbol<BasicBlock>(labels, &lbl);
+        BasicBlock *&bb = labels[lbl.number("id")];
         if (!bb) {
             bb = createAndInsertBB(lbl.asstring("value"));
-            mapSymbol(labels, &lbl, bb);
         }
         labeldepth->push();
         lbl.push();
@@ -2519,7 +3233,15 @@ struct FunctionEmitter {
 
         call->obj("value", &func);
 
-        Value *fn = emitExp(&func);
+        // direct calls of Terra functions go to their internal variant if they have one
+        TerraFunctionState *callee = NULL;
+        Obj global;
+        if (func.kind("kind") == T_globalvalueref && func.obj("value", &global) &&
+            T_globalvariable != global.kind("kind")) {
+            setDebugPoint(&func);
+            callee = EmitFunctionState(CU, &global, fstate);
+        }
+        Value *fn = (callee && callee->fastfunc) ? NULL : emitExp(&func);
 
         Obj fnptrtyp;
         func.obj("type", &fnptrtyp);
@@ -2534,13 +3256,24 @@ struct FunctionEmitter {
             setInsertBlock(bb);
             deferred.push_back(bb);
         }
-        Value *r = CC->EmitCall(B, &fntyp, &paramtypes, fn, &actuals);
+        Value *r;
+        if (!fn) {
+            CallInst *c = B->CreateCall(callee->fastfunc, actuals);
+            c->setCallingConv(CallingConv::Fast);
+            Obj returntype;
+            fntyp.obj("returntype", &returntype);
+            r = c;
+            if (c->getType()->isVoidTy())  // unit result
+                r = UndefValue::get(getType(&returntype)->type);
+        } else {
+            r = CC->EmitCall(B, &fntyp, &paramtypes, fn, &actuals);
+        }
         setInsertBlock(cur);  // defer may have changed it
         return r;
     }
 
     void emitReturnUndef() {
-        Type *rt = fstate->func->getReturnType();
+        Type *rt = body->getReturnType();
         if (rt->isVoidTy()) {
             B->CreateRetVoid();
         } else {
@@ -2591,7 +3324,7 @@ struct FunctionEmitter {
     }
     BasicBlock *copyBlock(BasicBlock *BB) {
         ValueToValueMapTy VMap;
-        BasicBlock *NewBB = CloneBasicBlock(BB, VMap, "", fstate->func);
+        BasicBlock *NewBB = CloneBasicBlock(BB, VMap, "", body);
         for (BasicBlock::iterator II = NewBB->begin(), IE = NewBB->end(); II != IE; ++II)
             RemapInstruction(&*II, VMap,
 #if LLVM_VERSION < 39
@@ -2624,13 +3357,92 @@ struct FunctionEmitter {
     }
     void enterScope(Locals *buf) {
         buf->prev = locals;
-        newMap(&buf->cur);
+        buf->mark = shadowed.size();
         locals = buf;
     }
     void leaveScope() {
         assert(locals);
+        for (; shadowed.size() > locals->mark; shadowed.pop_back()) {
+            std::pair<int, Value *> &s = shadowed.back();
+            if (s.second)
+                variables[s.first] = s.second;
+            else
+                variables.erase(s.first);
+        }
         locals = locals->prev;
     }
+#if LLVM_VERSION <= 35
+    typedef Value LoopMetadata;
+#else
+    typedef Metadata LoopMetadata;
+#endif
+    MDNode *loopHint(const char *name, int value = -1) {
+        LLVMContext &ctx = *CU->TT->ctx;
+        std::vector<LoopMetadata *> ops;
+        ops.push_back(MDString::get(ctx, name));
+        if (value >= 0) {
+            Constant *c = ConstantInt::get(Type::getInt32Ty(ctx), value);
+#if LLVM_VERSION <= 35
+            ops.push_back(c);
+#else
+            ops.push_back(ConstantAsMetadata::get(c));
+#endif
+        }
+        return MDNode::get(ctx, ops);
+    }
+    // turn the hints attached by terralib.loophint into llvm.loop metadata on every
+    // back edge of the loop whose header is header
+    void emitLoopHints(Obj *stmt, BasicBlock *header, BasicBlock *preheader) {
+        Obj hints;
+        if (!stmt->obj("loophints", &hints)) return;
+        LLVMContext &ctx = *CU->TT->ctx;
+        std::vector<LoopMetadata *> ops;
+#if LLVM_VERSION <= 36
+        MDNode *temp = MDNode::getTemporary(ctx, ArrayRef<LoopMetadata *>());
+        ops.push_back(temp);
+#else
+        TempMDTuple temp = MDNode::getTemporary(ctx, None);
+        ops.push_back(temp.get());
+#endif
+        if (hints.hasfield("unroll")) {
+            hints.pushfield("unroll");
+            if (lua_isnumber(L, -1))
+                ops.push_back(loopHint("llvm.loop.unroll.count", lua_tointeger(L, -1)));
+            else if (lua_toboolean(L, -1))
+                ops.push_back(loopHint("llvm.loop.unroll.full"));
+            else
+                ops.push_back(loopHint("llvm.loop.unroll.disable"));
+            lua_pop(L, 1);
+        }
+        if (hints.hasfield("vectorize")) {
+            if (hints.boolean("vectorize"))
+                ops.push_back(loopHint("llvm.loop.vectorize.enable", 1));
+            else
+                ops.push_back(loopHint("llvm.loop.vectorize.width", 1));
+        }
+        if (hints.hasfield("vectorizewidth")) {
+            int width = hints.number("vectorizewidth");
+            ops.push_back(loopHint("llvm.loop.vectorize.width", width));
+        }
+        if (hints.hasfield("interleave")) {
+#if LLVM_VERSION <= 35
+            const char *interleave = "llvm.loop.vectorize.unroll";
+#else
+            const char *interleave = "llvm.loop.interleave.count";
+#endif
+            ops.push_back(loopHint(interleave, hints.number("interleave")));
+        }
+        MDNode *loopid = MDNode::get(ctx, ops);
+        loopid->replaceOperandWith(0, loopid);
+#if LLVM_VERSION <= 36
+        MDNode::deleteTemporary(temp);
+#endif
+        for (pred_iterator it = pred_begin(header), end = pred_end(header); it != end;
+             ++it) {
+            if (*it == preheader) continue;
+            (*it)->getTerminator()->setMetadata("llvm.loop", loopid);
+        }
+    }
     void emitStmt(Obj *stmt) {
         setDebugPoint(stmt);
         T_Kind kind = stmt->kind("kind");
@@ -2653,7 +3465,12 @@ struct FunctionEmitter {
                 Obj ftype;
                 funcobj->obj("type", &ftype);
                 emitDeferred(deferred.size());
-                CC->EmitReturn(B, &ftype, fstate->func, result);
+                if (!fstate->fastfunc)
+                    CC->EmitReturn(B, &ftype, fstate->func, result);
+                else if (body->getReturnType()->isVoidTy())
+                    B->CreateRetVoid();
+                else
+                    B->CreateRet(result);
                 startDeadCode();
             } break;
             case T_label: {
@@ -2685,6 +3502,7 @@ struct FunctionEmitter {
                 stmt->obj("condition", &cond);
                 stmt->obj("body", &body);
                 BasicBlock *condBB = createAndInsertBB("condition");
+                BasicBlock *preheader = B->GetInsertBlock();
 
                 B->CreateBr(condBB);
                 setInsertBlock(condBB);
@@ -2699,6 +3517,7 @@ struct FunctionEmitter {
                 emitStmt(&body);
 
                 B->CreateBr(condBB);
+                emitLoopHints(stmt, condBB, preheader);
 
                 followsBB(merge);
                 setInsertBlock(merge);
@@ -2720,6 +3539,7 @@ struct FunctionEmitter {
                 Value *zero = ConstantInt::get(t->type, 0);
                 B->CreateStore(initialv, vp);
                 BasicBlock *cond = createAndInsertBB("forcond");
+                BasicBlock *preheader = B->GetInsertBlock();
                 B->CreateBr(cond);
                 setInsertBlock(cond);
                 Value *v = B->CreateLoad(vp);
@@ -2735,6 +3555,7 @@ struct FunctionEmitter {
                 emitStmt(&body);
                 B->CreateStore(B->CreateAdd(v, stepv), vp);
                 B->CreateBr(cond);
+                emitLoopHints(stmt, cond, preheader);
                 followsBB(merge);
                 setInsertBlock(merge);
 
@@ -2766,6 +3587,7 @@ struct FunctionEmitter {
 
                 pushBreakpoint(merge);
 
+                BasicBlock *header = loopBody, *preheader = B->GetInsertBlock();
                 B->CreateBr(loopBody);
                 setInsertBlock(loopBody);
                 size_t N = deferred.size();
@@ -2783,6 +3605,7 @@ struct FunctionEmitter {
                     loopBody = backedge;
                 }
                 emitBranchOnExpr(&cond, merge, loopBody);
+                emitLoopHints(stmt, header, preheader);
                 followsBB(merge);
                 setInsertBlock(merge);
                 unwindDeferred(N);
@@ -2826,12 +3649,22 @@ struct FunctionEmitter {
 };
 
 static Constant *EmitConstantInitializer(TerraCompilationUnit *CU, Obj *v) {
+    if (v->kind("kind") == T_constant) {  // no code needs to run to get the value
+        Obj type;
+        v->obj("type", &type);
+        CU->Ty->EnsureTypeIsComplete(&type);
+        v->pushfield("value");
+        const char *data = (const char *)lua_topointer(CU->T->L, -1);
+        Constant *r = EmitConstantFromMemory(CU, CU->Ty->Get(&type)->type, data);
+        lua_pop(CU->T->L, 1);
+        return r;
+    }
     FunctionEmitter fe(CU);
     return fe.emitConstantExpression(v);
 }
 
-Function *EmitFunction(TerraCompilationUnit *CU, Obj *funcdecl,
-                       TerraFunctionState *user) {
+TerraFunctionState *EmitFunctionState(TerraCompilationUnit *CU, Obj *funcdecl,
+                                      TerraFunctionState *user) {
     Obj funcdefn;
     funcdecl->obj("definition", &funcdefn);
     FunctionEmitter fe(CU);
@@ -2840,7 +3673,11 @@ Function *EmitFunction(TerraCompilationUnit *CU, Obj *funcdecl,
         user->lowlink =
                 std::min(user->lowlink, result->lowlink);  // Tarjan's scc algorithm
 
-    return result->func;
+    return result;
+}
+Function *EmitFunction(TerraCompilationUnit *CU, Obj *funcdecl,
+                       TerraFunctionState *user) {
+    return EmitFunctionState(CU, funcdecl, user)->func;
 }
 
 static int terra_compilationunitaddvalue(
@@ -2850,22 +3687,26 @@ static int terra_compilationunitaddvalue(
     // create lua table to hold object references anchored on stack
     int ref_table = lobj_newreftable(T->L);
     {
-        Obj cu, globals, value;
+        Obj cu, globals, types, value;
         lua_pushvalue(L, COMPILATION_UNIT_POS);  // the compilation unit
         cu.initFromStack(L, ref_table);
         cu.obj("symbols", &globals);
+        cu.obj("types", &types);
         const char *modulename = (lua_isnil(L, 2)) ? NULL : lua_tostring(L, 2);
         lua_pushvalue(L, 3);  // the function definition
         cu.fromStack(&value);
         TerraCompilationUnit *CU = (TerraCompilationUnit *)cu.cd("llvm_cu");
         assert(CU);
+        CU->optlevel = llvmutil_parseoptlevel(cu.string("optlevel"));
+        if (CU->optimize) InitializePasses(CU);
+        CU->strictaliasing = cu.boolean("strictaliasing");
+        CU->compactcode = cu.boolean("compactcode");
+        CU->hugepages = cu.boolean("hugepages");
 
-        Types Ty(CU);
-        CCallingConv CC(CU, &Ty);
+        InitializeTypes(CU);
         std::vector<TerraFunctionState *> tooptimize;
-        CU->Ty = &Ty;
-        CU->CC = &CC;
         CU->symbols = &globals;
+        CU->types = &types;
         CU->tooptimize = &tooptimize;
         if (value.kind("kind") == T_globalvariable) {
             gv = EmitGlobalVariable(CU, &value, "anon");
@@ -2874,10 +3715,14 @@ static int terra_compilationunitaddvalue(
         }
         gv->setLinkage(
                 GlobalValue::ExternalLinkage);  // User explicitly exported this function.
-        CU->Ty = NULL;
-        CU->CC = NULL;
         CU->symbols = NULL;
+        CU->types = NULL;
         CU->tooptimize = NULL;
+#if LLVM_VERSION >= 50
+        // complete the debug info of the functions emitted here before the JIT or
+        // saveobj copies them out of M. DIBuilder allows finalizing more than once.
+        if (CU->dibuilder) CU->dibuilder->finalize();
+#endif
         if (modulename) {
             if (GlobalValue *gv2 = CU->M->getNamedValue(modulename))
                 gv2->setName(
@@ -2901,16 +3746,20 @@ static int terra_llvmsizeof(lua_State *L) {
     TType *llvmtyp;
     TerraCompilationUnit *CU;
     {
-        Obj cu, typ, globals;
+        Obj cu, typ, globals, types;
         lua_pushvalue(L, 1);
         cu.initFromStack(L, ref_table);
         lua_pushvalue(L, 2);
         typ.initFromStack(L, ref_table);
         cu.obj("symbols", &globals);
+        cu.obj("types", &types);
         CU = (TerraCompilationUnit *)cu.cd("llvm_cu");
         CU->symbols = &globals;
-        llvmtyp = Types(CU).Get(&typ);
+        CU->types = &types;
+        InitializeTypes(CU);
+        llvmtyp = CU->Ty->Get(&typ);
         CU->symbols = NULL;
+        CU->types = NULL;
     }
     lobj_removereftable(T->L, ref_table);
     lua_pushnumber(T->L, CU->getDataLayout().getTypeAllocSize(llvmtyp->type));
@@ -2919,9 +3768,6 @@ static int terra_llvmsizeof(lua_State *L) {
 
 #ifdef TERRA_CAN_USE_MCJIT
 static void *GetGlobalValueAddress(TerraCompilationUnit *CU, StringRef Name) {
-    if (CU->T->options.debug > 1)
-        return sys::DynamicLibrary::SearchForAddressOfSymbol(Name);
-
     return (void *)CU->ee->getGlobalValueAddress(Name);
 }
 static bool MCJITShouldCopy(GlobalValue *G, void *data) {
@@ -2932,8 +3778,92 @@ static bool MCJITShouldCopy(GlobalValue *G, void *data) {
 }
 #endif
 
-static bool SaveSharedObject(TerraCompilationUnit *CU, Module *M,
-                             std::vector<const char *> *args, const char *filename);
+// give M its own copy of every C definition that it only declares, for saved objects
+// that do not get linked against the target's shared external JIT
+static void CopyExternalDefinitions(TerraCompilationUnit *CU, Module *M) {
+    std::vector<std::pair<std::string, bool> > decls;
+    for (Module::iterator it = M->begin(), end = M->end(); it != end; ++it)
+        if (it->isDeclaration()) decls.push_back(std::make_pair(it->getName().str(), true));
+    for (Module::global_iterator it = M->global_begin(), end = M->global_end(); it != end;
+         ++it)
+        if (it->isDeclaration()) decls.push_back(std::make_pair(it->getName().str(), false));
+    for (size_t i = 0; i < decls.size(); i++) {
+        Module *src;
+        GlobalValue *gv = LookupExternal(CU, decls[i].first, decls[i].second, &src);
+        if (gv && !gv->isDeclaration())
+            llvmutil_copyfrommodule(M, src, &gv, 1, AlwaysShouldCopy, NULL);
+    }
+}
+
+#if LLVM_VERSION > 40
+static bool ExternalShouldCopy(GlobalValue *G, void *data) {
+    TerraTarget *TT = (TerraTarget *)data;
+    if (!G->hasExternalLinkage()) return true;
+    return 0 == TT->externalee->getGlobalValueAddress(G->getName());
+}
+// compile the externally visible C definition of name (and what it uses) into the
+// execution engine shared by all compilation units of the target, at most once
+static void *JITExternalSymbol(TerraTarget *TT, StringRef name) {
+    Module *src;
+    std::string err;
+    GlobalValue *gv = LookupExternal(TT, name, true, &src, &err);
+    if (!gv && err.empty()) gv = LookupExternal(TT, name, false, &src, &err);
+    if (!gv && !err.empty()) {  // called while resolving symbols, so it cannot raise
+        fprintf(stderr, "linkllvm: reading %s: %s\n", name.str().c_str(), err.c_str());
+        return NULL;
+    }
+    if (!gv || gv->isDeclaration() || !gv->hasExternalLinkage()) return NULL;
+    if (!TT->externalee) {
+        Module *topeemodule = new Module("external", *TT->ctx);
+#ifdef _WIN32
+        topeemodule->setTargetTriple(TT->Triple + "-elf");
+#else
+        topeemodule->setTargetTriple(TT->Triple);
+#endif
+        std::string err;
+        std::vector<std::string> mattrs;
+        if (!TT->Features.empty()) mattrs.push_back(TT->Features);
+        EngineBuilder eb(UNIQUEIFY(Module, topeemodule));
+        eb.setErrorStr(&err)
+                .setMCPU(TT->CPU)
+                .setMAttrs(mattrs)
+                .setEngineKind(EngineKind::JIT)
+                .setTargetOptions(TT->tm->Options)
+                .setOptLevel(CodeGenOpt::Aggressive)
+                .setUseOrcMCJITReplacement(true);
+        TT->externalee = eb.create();
+        if (!TT->externalee) {
+            fprintf(stderr, "llvm: %s\n", err.c_str());
+            return NULL;
+        }
+    }
+    if (uint64_t addr = TT->externalee->getGlobalValueAddress(name)) return (void *)addr;
+    llvm::ValueToValueMapTy VMap;
+    Module *m = llvmutil_extractmodulewithproperties(name, src, &gv, 1, ExternalShouldCopy,
+                                                     TT, VMap);
+    TT->externalee->addModule(UNIQUEIFY(Module, m));
+    return (void *)TT->externalee->getGlobalValueAddress(name);
+}
+#endif
+
+#ifdef TERRA_CAN_REDIRECT_FUNCTIONS
+// functions marked redefinable start with no-ops the size of the jump that
+// terra_redirectfunction writes, so that even the shortest can be redirected without
+// overwriting any of its instructions
+static void AddPatchablePrologues(Module *m) {
+    static const uint8_t nops[RedirectSize] = {
+            0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00,  // nopl 0(%rax,%rax)
+            0x0F, 0x1F, 0x44, 0x00, 0x00};                   // nopl 0(%rax,%rax)
+    for (Module::iterator it = m->begin(), end = m->end(); it != end; ++it) {
+        Function *F = &*it;
+        if (F->isDeclaration() || F->hasPrologueData() ||
+            !F->hasFnAttribute("terra-redefinable"))
+            continue;
+        F->setPrologueData(ConstantDataArray::get(m->getContext(),
+                                                  ArrayRef<uint8_t>(nops, RedirectSize)));
+    }
+}
+#endif
 
 static void *JITGlobalValue(TerraCompilationUnit *CU, GlobalValue *gv) {
     InitializeJIT(CU);
@@ -2945,6 +3875,9 @@ static void *JITGlobalValue(TerraCompilationUnit *CU, GlobalValue *gv) {
             if (name.startswith(
                         "\01"))  // remove asm renaming tag before looking for symbol
                 name = name.substr(1);
+#if LLVM_VERSION > 40
+            if (void *addr = JITExternalSymbol(CU->TT, name)) return addr;
+#endif
             return ee->getPointerToNamedFunction(name);
         }
         void *ptr = GetGlobalValueAddress(CU, gv->getName());
@@ -2954,16 +3887,9 @@ static void *JITGlobalValue(TerraCompilationUnit *CU, GlobalValue *gv) {
         llvm::ValueToValueMapTy VMap;
         Module *m = llvmutil_extractmodulewithproperties(
                 gv->getName(), gv->getParent(), &gv, 1, MCJITShouldCopy, CU, VMap);
-
-        if (CU->T->options.debug > 1) {
-            llvm::SmallString<256> tmpname;
-            llvmutil_createtemporaryfile("terra", "so", tmpname);
-            if (SaveSharedObject(CU, m, NULL, tmpname.c_str())) lua_error(CU->T->L);
-            sys::DynamicLibrary::LoadLibraryPermanently(tmpname.c_str());
-            void *result = sys::DynamicLibrary::SearchForAddressOfSymbol(gv->getName());
-            assert(result);
-            return result;
-        }
+#ifdef TERRA_CAN_REDIRECT_FUNCTIONS
+        AddPatchablePrologues(m);
+#endif
         ee->addModule(UNIQUEIFY(Module, m));
         return (void *)ee->getGlobalValueAddress(gv->getName());
 #else
@@ -2974,6 +3900,35 @@ static void *JITGlobalValue(TerraCompilationUnit *CU, GlobalValue *gv) {
     }
 }
 
+// compile the definitions in gvs that are not compiled yet into a single object, so
+// that they share the relocation, section allocation and page protection work
+static void JITGlobalValues(TerraCompilationUnit *CU, std::vector<GlobalValue *> &gvs,
+                            std::vector<void *> *ptrs) {
+    InitializeJIT(CU);
+#ifdef TERRA_CAN_USE_MCJIT
+    if (CU->T->options.usemcjit) {
+        std::vector<GlobalValue *> todo;
+        for (size_t i = 0; i < gvs.size(); i++) {
+            GlobalValue *gv = gvs[i];
+            if (!gv->isDeclaration() && !GetGlobalValueAddress(CU, gv->getName()))
+                todo.push_back(gv);
+        }
+        if (!todo.empty()) {
+            llvm::ValueToValueMapTy VMap;
+            Module *m = llvmutil_extractmodulewithproperties(
+                    todo[0]->getName(), todo[0]->getParent(), &todo[0], todo.size(),
+                    MCJITShouldCopy, CU, VMap);
+#ifdef TERRA_CAN_REDIRECT_FUNCTIONS
+            AddPatchablePrologues(m);
+#endif
+            CU->ee->addModule(UNIQUEIFY(Module, m));
+        }
+    }
+#endif
+    // the first lookup finalizes the object, the others find their code in it
+    for (size_t i = 0; i < gvs.size(); i++) ptrs->push_back(JITGlobalValue(CU, gvs[i]));
+}
+
 static int terra_jit(lua_State *L) {
     terra_getstate(L, 1);
     TerraCompilationUnit *CU = (TerraCompilationUnit *)terra_tocdatapointer(L, 1);
@@ -2986,6 +3941,80 @@ static int terra_jit(lua_State *L) {
     return 2;
 }
 
+static int terra_jitbatch(lua_State *L) {
+    terra_getstate(L, 1);
+    TerraCompilationUnit *CU = (TerraCompilationUnit *)terra_tocdatapointer(L, 1);
+    std::vector<GlobalValue *> gvs;
+    int N = lua_objlen(L, 2);
+    for (int i = 1; i <= N; i++) {
+        lua_rawgeti(L, 2, i);
+        gvs.push_back((GlobalValue *)lua_touserdata(L, -1));
+        lua_pop(L, 1);
+    }
+    double begin = CurrentTimeInSeconds();
+    std::vector<void *> ptrs;
+    JITGlobalValues(CU, gvs, &ptrs);
+    double t = CurrentTimeInSeconds() - begin;
+    lua_createtable(L, N, 0);
+    for (int i = 0; i < N; i++) {
+        lua_pushlightuserdata(L, ptrs[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_pushnumber(L, t);
+    return 2;
+}
+
+// overwrite the entry of the JIT compiled function at from with a jump to to, so that
+// pointers to a function which has since been redefined reach its new code. returns
+// false if from could not be patched: on other architectures, or if its code is too
+// short for the jump. unless from was marked redefinable, and so starts with no-ops,
+// its first instructions are overwritten, which is unsafe while any thread is running
+// them or would return into them
+static int terra_redirectfunction(lua_State *L) {
+    terra_State *T = terra_getstate(L, 1);
+    void *from = lua_touserdata(L, 1);
+    void *to = lua_touserdata(L, 2);
+    bool patched = false;
+#ifdef TERRA_CAN_REDIRECT_FUNCTIONS
+    static const size_t stubsize = RedirectSize;
+    DenseMap<const void *, TerraFunctionInfo>::iterator it =
+            T->C->functioninfo.find(from);
+    if (it != T->C->functioninfo.end() && it->second.size >= stubsize) {
+        uint8_t stub[stubsize] = {0x49, 0xBB, 0, 0, 0, 0, 0, 0, 0, 0, 0x41, 0xFF, 0xE3};
+        memcpy(stub + 2, &to, sizeof(to));
+        uintptr_t pagesize = sys::Process::getPageSize();
+        uintptr_t begin = (uintptr_t)from & ~(pagesize - 1);
+        uintptr_t end = ((uintptr_t)from + stubsize + pagesize - 1) & ~(pagesize - 1);
+        sys::MemoryBlock block((void *)begin, end - begin);
+        if (!sys::Memory::protectMappedMemory(block, sys::Memory::MF_READ |
+                                                             sys::Memory::MF_WRITE |
+                                                             sys::Memory::MF_EXEC)) {
+            memcpy(from, stub, stubsize);
+            sys::Memory::protectMappedMemory(block,
+                                             sys::Memory::MF_READ | sys::Memory::MF_EXEC);
+            sys::Memory::InvalidateInstructionCache(from, stubsize);
+            patched = true;
+        }
+    }
+#endif
+    lua_pushboolean(L, patched);
+    return 1;
+}
+
+static void DeleteFunction(TerraCompilationUnit *CU, Function *func) {
+    if (!func->use_empty() ||
+        CU->T->options.usemcjit) {  // for MCJIT, we need to keep the declaration so
+                                    // another function doesn't get the same name
+        VERBOSE_ONLY(CU->T) {
+            printf("... uses not empty, removing body but keeping declaration.\n");
+        }
+        func->deleteBody();
+    } else if (CU->mi) {
+        CU->mi->eraseFunction(func);
+    } else {
+        func->eraseFromParent();
+    }
+}
 static int terra_deletefunction(lua_State *L) {
     TerraCompilationUnit *CU =
             (TerraCompilationUnit *)terra_tocdatapointer(L, lua_upvalueindex(1));
@@ -3003,18 +4032,11 @@ static int terra_deletefunction(lua_State *L) {
         CU->ee->freeMachineCodeForFunction(func);
     }
 #endif
-    if (!func->use_empty() ||
-        CU->T->options.usemcjit) {  // for MCJIT, we need to keep the declaration so
-                                    // another function doesn't get the same name
-        VERBOSE_ONLY(CU->T) {
-            printf("... uses not empty, removing body but keeping declaration.\n");
-        }
-        func->deleteBody();
-    } else {
-        CU->mi->eraseFunction(func);
-    }
+    DeleteFunction(CU, func);
+    if (fstate->fastfunc) DeleteFunction(CU, fstate->fastfunc);
     VERBOSE_ONLY(CU->T) { printf("... finish delete.\n"); }
     fstate->func = NULL;
+    fstate->fastfunc = NULL;
     freecompilationunit(CU);
     return 0;
 }
@@ -3163,13 +4185,17 @@ static int terra_saveobjimpl(lua_State *L) {
     const char *filename = lua_tostring(L, 1);  // NULL means write to memory
     std::string filekind = lua_tostring(L, 2);
     int argument_index = 4;
-    bool optimize = lua_toboolean(L, 5);
+    // NULL when the module is not optimized, otherwise the name of the level
+    const char *optimize = lua_tostring(L, 5);
 
     lua_getfield(L, 3, "llvm_cu");
     TerraCompilationUnit *CU = (TerraCompilationUnit *)terra_tocdatapointer(L, -1);
     assert(CU);
+    CopyExternalDefinitions(CU, CU->M);
     if (optimize) {
-        llvmutil_optimizemodule(CU->M, CU->TT->tm);
+        llvmutil_optimizemodule(CU->M, CU->TT->tm, llvmutil_parseoptlevel(optimize));
+        CU->strings.clear();  // unused literals and constants may have been deleted
+        CU->aggregates.clear();
     }
     // TODO: interialize the non-exported functions?
     std::vector<const char *> args;
@@ -3253,6 +4279,25 @@ static int terra_linkllvmimpl(lua_State *L) {
     size_t length;
     const char *filename = lua_tolstring(L, 2, &length);
     bool fromstring = lua_toboolean(L, 3);
+#if LLVM_VERSION >= 50
+    // a file is considered unchanged while both its size and its modification time
+    // are, since many file systems only keep the time to the second
+    int64_t mtime = 0;
+    uint64_t size = 0;
+    if (!fromstring) {
+        sys::fs::file_status status;
+        if (!sys::fs::status(filename, status)) {
+            mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            status.getLastModificationTime().time_since_epoch())
+                            .count();
+            size = status.getSize();
+        }
+        StringMap<TerraLinkedBitcode>::iterator it = TT->linkedbitcode.find(filename);
+        if (it != TT->linkedbitcode.end() && it->second.mtime == mtime &&
+            it->second.size == size)
+            return 0;  // already linked and the file has not changed since
+    }
+#endif
 #if LLVM_VERSION <= 34
     OwningPtr<MemoryBuffer> mb;
     error_code ec = MemoryBuffer::getFile(filename, mb);
@@ -3264,7 +4309,7 @@ static int terra_linkllvmimpl(lua_State *L) {
     ErrorOr<std::unique_ptr<MemoryBuffer> > mb = std::error_code();
     if (fromstring) {
         std::unique_ptr<MemoryBuffer> mbcontents(
-                MemoryBuffer::getMemBuffer(StringRef(filename, length), "", false));
+                MemoryBuffer::getMemBufferCopy(StringRef(filename, length), ""));
         mb = std::move(mbcontents);
     } else {
         mb = MemoryBuffer::getFile(filename);
@@ -3279,8 +4324,10 @@ static int terra_linkllvmimpl(lua_State *L) {
 #if LLVM_VERSION == 36
     ErrorOr<Module *> mm = parseBitcodeFile(mb.get()->getMemBufferRef(), *TT->ctx);
 #elif LLVM_VERSION >= 50
+    // only the symbol table is read here, function bodies are materialized when
+    // they are first copied into a compilation unit
     Expected<std::unique_ptr<Module> > mm =
-            parseBitcodeFile(mb.get()->getMemBufferRef(), *TT->ctx);
+            getOwningLazyBitcodeModule(std::move(mb.get()), *TT->ctx);
 #elif LLVM_VERSION >= 37
     ErrorOr<std::unique_ptr<Module> > mm =
             parseBitcodeFile(mb.get()->getMemBufferRef(), *TT->ctx);
@@ -3318,7 +4365,22 @@ static int terra_linkllvmimpl(lua_State *L) {
 #endif
 #endif
     M->setTargetTriple(TT->Triple);
-#if LLVM_VERSION < 39
+#if LLVM_VERSION >= 50
+    if (fromstring) {
+        TT->lazyexternals.push_back(M);
+        return 0;
+    }
+    TerraLinkedBitcode &entry = TT->linkedbitcode[filename];
+    if (entry.M) {  // the file changed on disk, replace the stale module
+        std::replace(TT->lazyexternals.begin(), TT->lazyexternals.end(), entry.M, M);
+        delete entry.M;
+    } else {
+        TT->lazyexternals.push_back(M);
+    }
+    entry.mtime = mtime;
+    entry.size = size;
+    entry.M = M;
+#elif LLVM_VERSION < 39
     char *err;
     if (LLVMLinkModules(llvm::wrap(TT->external), llvm::wrap(M), LLVMLinkerDestroySource,
                         &err)) {
@@ -3340,6 +4402,25 @@ static int terra_linkllvmimpl(lua_State *L) {
 #endif
     return 0;
 }
+// the functions of the bitcode file linked with linkllvm whose bodies have been read so
+// far, as a table from name to true
+static int terra_linkedfunctions(lua_State *L) {
+    terra_getstate(L, 1);
+    TerraTarget *TT = (TerraTarget *)terra_tocdatapointer(L, 1);
+    const char *filename = luaL_checkstring(L, 2);
+    lua_newtable(L);
+#if LLVM_VERSION >= 50
+    StringMap<TerraLinkedBitcode>::iterator it = TT->linkedbitcode.find(filename);
+    if (it == TT->linkedbitcode.end()) return 1;
+    Module *M = it->second.M;
+    for (Module::iterator F = M->begin(), E = M->end(); F != E; ++F) {
+        if (F->isMaterializable() || F->isDeclaration()) continue;
+        lua_pushboolean(L, true);
+        lua_setfield(L, -2, F->getName().str().c_str());
+    }
+#endif
+    return 1;
+}
 
 static int terra_dumpmodule(lua_State *L) {
     terra_State *T = terra_getstate(L, 1);
@@ -3348,3 +4429,69 @@ static int terra_dumpmodule(lua_State *L) {
     if (CU) TERRA_DUMP_MODULE(CU->M);
     return 0;
 }
+
+static void PushModuleReport(lua_State *L, Module *M, int i) {
+    size_t nfunctions = 0, ndefinitions = 0, ninstructions = 0;
+    bool materialized = true;
+    for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
+        nfunctions++;
+#if LLVM_VERSION >= 50
+        if (f->isMaterializable()) {
+            materialized = false;
+            continue;
+        }
+#endif
+        if (f->isDeclaration()) continue;
+        ndefinitions++;
+        for (Function::iterator bb = f->begin(), be = f->end(); bb != be; ++bb)
+            ninstructions += bb->size();
+    }
+    lua_newtable(L);
+    lua_pushstring(L, M->getModuleIdentifier().c_str());
+    lua_setfield(L, -2, "name");
+    lua_pushnumber(L, nfunctions);
+    lua_setfield(L, -2, "functions");
+    lua_pushnumber(L, ndefinitions);
+    lua_setfield(L, -2, "definitions");
+    lua_pushnumber(L, ninstructions);
+    lua_setfield(L, -2, "instructions");
+    if (materialized) {  // the bitcode size is a proxy for the IR held in memory
+        SmallVector<char, 256> mem;
+        raw_svector_ostream dest(mem);
+#if LLVM_VERSION < 70
+        llvm::WriteBitcodeToFile(M, dest);
+#else
+        llvm::WriteBitcodeToFile(*M, dest);
+#endif
+        lua_pushnumber(L, dest.str().size());
+        lua_setfield(L, -2, "bytes");
+    }
+    lua_rawseti(L, -2, i);
+}
+// IR held by a compilation unit and the target it shares external C code with
+static int terra_memoryreport(lua_State *L) {
+    terra_State *T = terra_getstate(L, 1);
+    (void)T;
+    TerraCompilationUnit *CU = (TerraCompilationUnit *)terra_tocdatapointer(L, 1);
+    int i = 1;
+    lua_newtable(L);
+    PushModuleReport(L, CU->M, i++);
+    PushModuleReport(L, CU->TT->external, i++);
+    for (size_t j = 0; j < CU->TT->lazyexternals.size(); j++)
+        PushModuleReport(L, CU->TT->lazyexternals[j], i++);
+    return 1;
+}
+
+// the use of the JIT memory of a compilation unit, or nil when it has none of its own
+static int terra_jitmemoryreport(lua_State *L) {
+    terra_getstate(L, 1);
+    TerraCompilationUnit *CU = (TerraCompilationUnit *)terra_tocdatapointer(L, 1);
+#if LLVM_VERSION > 40
+    if (CU->memorymanager) {
+        CU->memorymanager->pushReport(L);
+        return 1;
+    }
+#endif
+    lua_pushnil(L);
+    return 1;
+}
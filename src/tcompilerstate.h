@@ -3,55 +3,98 @@
 
 #include "llvmheaders.h"
 #include "tinline.h"
+#include "tllvmutil.h"
 
+struct TerraLineStart {  // start of the code generated for a source line
+    uintptr_t addr;
+    size_t line;
+    llvm::StringRef file;  // a key of terra_CompilerState::linefiles
+};
 struct TerraFunctionInfo {
     llvm::LLVMContext *ctx;
     std::string name;
     void *addr;
     size_t size;
     llvm::JITEvent_EmittedFunctionDetails efd;
+    std::vector<TerraLineStart> lines;  // by address, read from DWARF in debug mode
 };
 class Types;
 struct CCallingConv;
+class TerraSectionMemoryManager;
 struct Obj;
 
+struct TerraLinkedBitcode {  // a bitcode file registered with linkllvm
+    TerraLinkedBitcode() : mtime(0), size(0), M(NULL) {}
+    int64_t mtime;           // modification time of the file when it was loaded, in ns
+    uint64_t size;           // and its size
+    llvm::Module *M;         // lazily materialized module, owned by the target
+};
+
 struct TerraTarget {
     TerraTarget()
-            : nreferences(0), tm(NULL), ctx(NULL), external(NULL), next_unused_id(0) {}
+            : nreferences(0),
+              tm(NULL),
+              ctx(NULL),
+              external(NULL),
+              externalee(NULL),
+              next_unused_id(0) {}
     int nreferences;
     std::string Triple, CPU, Features;
     llvm::TargetMachine *tm;
     llvm::LLVMContext *ctx;
     llvm::Module *external;  // module that holds IR for externally included things (from
                              // includec or linkllvm)
+    std::vector<llvm::Module *> lazyexternals;  // bitcode from linkllvm whose function
+                                                // bodies are only read when first used
+    llvm::StringMap<TerraLinkedBitcode> linkedbitcode;  // lazyexternals by file path
+    llvm::ExecutionEngine *externalee;  // JIT shared by all compilation units for the
+                                        // externally visible C code in external
     size_t next_unused_id;   // for creating names for dummy functions
     size_t id;
 };
 
 struct TerraFunctionState {  // compilation state
     llvm::Function *func;
+    llvm::Function *fastfunc;  // internal calling convention variant of func, or NULL
     int index, lowlink;  // for Tarjan's scc algorithm
     bool onstack;
+    llvmutil_OptLevel optlevel;  // the function's own level or that of its unit
 };
 
 struct TerraCompilationUnit {
     TerraCompilationUnit()
             : nreferences(0),
               optimize(false),
+              optlevel(llvmutil_O3),
+              strictaliasing(false),
+              compactcode(false),
+              hugepages(false),
               T(NULL),
               C(NULL),
               M(NULL),
               mi(NULL),
-              fpm(NULL),
+              fpm(),
               ee(NULL),
               jiteventlistener(NULL),
+              memorymanager(NULL),
               Ty(NULL),
               CC(NULL),
               symbols(NULL),
-              functioncount(0) {}
+              types(NULL),
+              tbaachar(NULL),
+              functioncount(0) {
+#if LLVM_VERSION >= 50
+        dibuilder = NULL;
+        dicompileunit = NULL;
+#endif
+    }
     int nreferences;
     // configuration
     bool optimize;
+    llvmutil_OptLevel optlevel;  // default for functions, read on each addvalue
+    bool strictaliasing;  // emit TBAA metadata, read from the Lua object on each addvalue
+    bool compactcode;     // pack JIT code of different objects into the same pages
+    bool hugepages;       // back JIT code with 2MB pages, both read like strictaliasing
 
     // LLVM state used in compiltion unit
     terra_State *T;
@@ -59,15 +102,29 @@ struct TerraCompilationUnit {
     TerraTarget *TT;
     llvm::Module *M;
     ManualInliner *mi;
-    FunctionPassManager *fpm;
+    llvmutil_FunctionOptimizer *fpm[llvmutil_NOPTLEVELS];  // created on first use
     llvm::ExecutionEngine *ee;
     llvm::JITEventListener *jiteventlistener;  // for reporting debug info
-    // Temporary storage for objects that exist only during emitting functions
+    TerraSectionMemoryManager *memorymanager;  // owned by ee, NULL before the first JIT
+    // type layouts and calling convention classifications, created on first use
     Types *Ty;
     CCallingConv *CC;
+    // Temporary storage for objects that exist only during emitting functions
     Obj *symbols;
+    Obj *types;  // the CU's strong table of the types that Ty and CC cache, set with symbols
+    llvm::StringMap<llvm::Value *> strings;  // string literals already emitted in M
+    llvm::DenseMap<llvm::Constant *, llvm::GlobalVariable *>
+            aggregates;  // aggregate constants already emitted in M, by value
+    llvm::MDNode *tbaachar;  // TBAA type of 8-bit accesses, parent of the other types
+    llvm::DenseMap<llvm::Type *, llvm::MDNode *> tbaa;  // TBAA access tags by type
     int functioncount;  // for assigning unique indexes to functions;
     std::vector<TerraFunctionState *> *tooptimize;
+#if LLVM_VERSION >= 50
+    // debug info of M in debug mode, created with its first function
+    llvm::DIBuilder *dibuilder;
+    llvm::DICompileUnit *dicompileunit;
+    llvm::StringMap<llvm::DIFile *> difiles;  // by the file name in the Terra code
+#endif
     const llvm::DataLayout &getDataLayout() {
 #if LLVM_VERSION <= 35
         return *M->getDataLayout();
@@ -81,6 +138,7 @@ struct terra_CompilerState {
     int nreferences;
     llvm::sys::MemoryBlock MB;
     llvm::DenseMap<const void *, TerraFunctionInfo> functioninfo;
+    llvm::StringMap<char> linefiles;  // file names of TerraFunctionInfo::lines
 };
 
 #endif
\ No newline at end of file
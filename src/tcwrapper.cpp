@@ -27,6 +27,13 @@ extern "C" {
 #include "clang/Driver/Compilation.h"
 #include "clang/Driver/ToolChain.h"
 #include "tcompilerstate.h"
+#if LLVM_VERSION >= 50
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
 
 using namespace clang;
 
@@ -698,16 +705,64 @@ static llvm::sys::TimePoint<> ZeroTime() {
     return llvm::sys::TimePoint<>(std::chrono::nanoseconds::zero());
 }
 #endif
+class LuaOverlayFileSystem;
+
+#if LLVM_VERSION >= 50
+// clang instances running on worker threads cannot call the Lua header provider
+// themselves, so they queue their lookups here and the main thread answers them
+struct HeaderBroker {
+    struct Request {
+        std::string path;
+        clang::vfs::Status status;
+        StringRef contents;
+        bool found;
+        bool done;
+    };
+    std::mutex m;
+    std::condition_variable requested;  // signaled when a request arrives or a worker ends
+    std::condition_variable answered;
+    std::deque<Request *> requests;
+    int running;
+    HeaderBroker(int running_) : running(running_) {}
+    bool GetFile(const llvm::Twine &Path, clang::vfs::Status *status, StringRef *contents) {
+        Request r;
+        r.path = Path.str();
+        r.found = r.done = false;
+        std::unique_lock<std::mutex> lock(m);
+        requests.push_back(&r);
+        requested.notify_one();
+        answered.wait(lock, [&r] { return r.done; });
+        *status = r.status;
+        *contents = r.contents;
+        return r.found;
+    }
+    void WorkerFinished() {
+        std::lock_guard<std::mutex> lock(m);
+        running--;
+        requested.notify_one();
+    }
+    // run on the main thread until every worker has called WorkerFinished
+    void Serve(LuaOverlayFileSystem *FS);
+};
+#else
+struct HeaderBroker;
+#endif
+
 class LuaOverlayFileSystem : public clang::vfs::FileSystem {
 private:
     IntrusiveRefCntPtr<vfs::FileSystem> RFS;
     lua_State *L;
+    HeaderBroker *broker;
 
 public:
-    LuaOverlayFileSystem(lua_State *L_) : RFS(vfs::getRealFileSystem()), L(L_) {}
+    LuaOverlayFileSystem(lua_State *L_, HeaderBroker *broker_ = NULL)
+            : RFS(vfs::getRealFileSystem()), L(L_), broker(broker_) {}
 
     bool GetFile(const llvm::Twine &Path, clang::vfs::Status *status,
                  StringRef *contents) {
+#if LLVM_VERSION >= 50
+        if (broker) return broker->GetFile(Path, status, contents);
+#endif
         lua_pushvalue(L, HEADERPROVIDER_POS);
         lua_pushstring(L, Path.str().c_str());
         lua_call(L, 1, 1);
@@ -806,6 +861,24 @@ public:
 #endif
 };
 
+#if LLVM_VERSION >= 50
+void HeaderBroker::Serve(LuaOverlayFileSystem *FS) {
+    std::unique_lock<std::mutex> lock(m);
+    while (running > 0 || !requests.empty()) {
+        requested.wait(lock, [this] { return running == 0 || !requests.empty(); });
+        while (!requests.empty()) {
+            Request *r = requests.front();
+            requests.pop_front();
+            lock.unlock();
+            r->found = FS->GetFile(r->path, &r->status, &r->contents);
+            lock.lock();
+            r->done = true;
+            answered.notify_all();
+        }
+    }
+}
+#endif
+
 void InitHeaderSearchFlags(std::string const &TripleStr, HeaderSearchOptions &HSO) {
     using namespace llvm::sys;
 
@@ -851,7 +924,7 @@ void InitHeaderSearchFlags(std::string const &TripleStr, HeaderSearchOptions &HS
 
 static void initializeclang(terra_State *T, llvm::MemoryBuffer *membuffer,
                             const char **argbegin, const char **argend,
-                            CompilerInstance *TheCompInst) {
+                            CompilerInstance *TheCompInst, HeaderBroker *broker = NULL) {
 // CompilerInstance will hold the instance of the Clang compiler for us,
 // managing the various objects needed to run the compiler.
 #if LLVM_VERSION <= 32
@@ -878,7 +951,8 @@ static void initializeclang(terra_State *T, llvm::MemoryBuffer *membuffer,
     TargetInfo *TI = TargetInfo::CreateTargetInfo(TheCompInst->getDiagnostics(), to);
     TheCompInst->setTarget(TI);
 
-    llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> FS = new LuaOverlayFileSystem(T->L);
+    llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> FS =
+            new LuaOverlayFileSystem(T->L, broker);
     TheCompInst->setVirtualFileSystem(FS);
     TheCompInst->createFileManager();
     FileManager &FileMgr = TheCompInst->getFileManager();
@@ -908,11 +982,12 @@ static void initializeclang(terra_State *T, llvm::MemoryBuffer *membuffer,
 #endif
 }
 #if LLVM_VERSION >= 33
-static void AddMacro(terra_State *T, Preprocessor &PP, const IdentifierInfo *II,
-                     MacroDirective *MD, Obj *table) {
-    if (!II->hasMacroDefinition()) return;
+// the value of II if it is defined as a (possibly negated) numeric constant
+static bool MacroValue(Preprocessor &PP, const IdentifierInfo *II, MacroDirective *MD,
+                       double *result) {
+    if (!II->hasMacroDefinition() || !MD) return false;
     MacroInfo *MI = MD->getMacroInfo();
-    if (MI->isFunctionLike()) return;
+    if (!MI || MI->isFunctionLike()) return false;
     bool negate = false;
     const Token *Tok;
     if (MI->getNumTokens() == 2 && MI->getReplacementToken(0).is(clang::tok::minus)) {
@@ -921,16 +996,16 @@ static void AddMacro(terra_State *T, Preprocessor &PP, const IdentifierInfo *II,
     } else if (MI->getNumTokens() == 1) {
         Tok = &MI->getReplacementToken(0);
     } else {
-        return;
+        return false;
     }
 
-    if (Tok->isNot(clang::tok::numeric_constant)) return;
+    if (Tok->isNot(clang::tok::numeric_constant)) return false;
 
     SmallString<64> IntegerBuffer;
     bool NumberInvalid = false;
     StringRef Spelling = PP.getSpelling(*Tok, IntegerBuffer, &NumberInvalid);
     NumericLiteralParser Literal(Spelling, Tok->getLocation(), PP);
-    if (Literal.hadError) return;
+    if (Literal.hadError) return false;
     double V;
     if (Literal.isFloatingLiteral()) {
         llvm::APFloat Result(0.0);
@@ -941,18 +1016,18 @@ static void AddMacro(terra_State *T, Preprocessor &PP, const IdentifierInfo *II,
         Literal.GetIntegerValue(Result);
         int64_t i = Result.getSExtValue();
         if ((int64_t)(double)i != i)
-            return;  // right now we ignore things that are not representable in Lua's
-                     // number type eventually we should use LuaJITs ctype support to hold
-                     // the larger numbers
+            return false;  // right now we ignore things that are not representable in
+                           // Lua's number type eventually we should use LuaJITs ctype
+                           // support to hold the larger numbers
         V = i;
     }
     if (negate) V = -V;
-    lua_pushnumber(T->L, V);
-    table->setfield(II->getName().str().c_str());
+    *result = V;
+    return true;
 }
 #endif
 
-static void optimizemodule(TerraTarget *TT, llvm::Module *M) {
+static void optimizemodule(TerraTarget *TT, llvm::TargetMachine *tm, llvm::Module *M) {
     // cleanup after clang.
     // in some cases clang will mark stuff AvailableExternally (e.g. atoi on linux)
     // the linker will then delete it because it is not used.
@@ -979,16 +1054,19 @@ static void optimizemodule(TerraTarget *TT, llvm::Module *M) {
     M->setTargetTriple(
             TT->Triple);  // suppress warning that occur due to unmatched os versions
     PassManager opt;
-    llvmutil_addtargetspecificpasses(&opt, TT->tm);
+    llvmutil_addtargetspecificpasses(&opt, tm);
     opt.add(llvm::createFunctionInliningPass());
     llvmutil_addoptimizationpasses(&opt);
     opt.run(*M);
 }
+static void AddMacros(terra_State *T, CompilerInstance *TheCompInst, Obj *result);
+static void LinkExternal(terra_State *T, TerraTarget *TT, llvm::Module *M);
+
 static int dofile(terra_State *T, TerraTarget *TT, const char *code,
                   const char **argbegin, const char **argend, Obj *result) {
     // CompilerInstance will hold the instance of the Clang compiler for us,
     // managing the various objects needed to run the compiler.
-    CompilerInstance TheCompInst;
+    CompilerInstance &TheCompInst = *new CompilerInstance();  // owned by AddMacros
 
 #if LLVM_VERSION >= 36
     llvm::MemoryBuffer *membuffer =
@@ -1030,34 +1108,81 @@ static int dofile(terra_State *T, TerraTarget *TT, const char *code,
 
     ParseAST(TheCompInst.getSema(), false, false);
 
-    Obj macros;
-    CreateTableWithName(result, "macros", &macros);
+    llvm::Module *M = codegen->ReleaseModule();
+    delete codegen;
+
+    AddMacros(T, &TheCompInst, result);
+    if (!M) {
+        terra_reporterror(T, "compilation of included c code failed\n");
+    }
+    optimizemodule(TT, TT->tm, M);
+    LinkExternal(T, TT, M);
+    return 0;
+}
+
+#if LLVM_VERSION >= 33
+static int freemacros(lua_State *L) {
+    CompilerInstance **CI = (CompilerInstance **)lua_touserdata(L, 1);
+    delete *CI;
+    *CI = NULL;
+    return 0;
+}
+// lookupmacro(name): the numeric value of macro name, or nil
+static int lookupmacro(lua_State *L) {
+    CompilerInstance *CI = *(CompilerInstance **)lua_touserdata(L, lua_upvalueindex(1));
+    const char *name = luaL_checkstring(L, 1);
+    Preprocessor &PP = CI->getPreprocessor();
+    IdentifierInfo *II = PP.getIdentifierInfo(name);
+#if LLVM_VERSION <= 36
+    MacroDirective *MD = PP.getMacroDirective(II);
+#else
+    MacroDirective *MD = PP.getLocalMacroDirective(II);
+#endif
+    double V;
+    if (MacroValue(PP, II, MD, &V))
+        lua_pushnumber(L, V);
+    else
+        lua_pushnil(L);
+    return 1;
+}
+#endif
 
+// takes ownership of TheCompInst. Headers define thousands of macros of which only a
+// few are ever used, so rather than evaluating all of them up front we keep the
+// preprocessor alive and let Lua look up the ones it asks for.
+static void AddMacros(terra_State *T, CompilerInstance *TheCompInst, Obj *result) {
+    // the consumer holds references into the current Lua stack, and the AST is not
+    // needed anymore
+    TheCompInst->setSema(NULL);
+#if LLVM_VERSION >= 37
+    TheCompInst->setASTConsumer(nullptr);
+#else
+    TheCompInst->setASTConsumer(NULL);
+#endif
+    TheCompInst->setASTContext(NULL);
 #if LLVM_VERSION >= 33
-    Preprocessor &PP = TheCompInst.getPreprocessor();
+    lua_State *L = T->L;
+    Preprocessor &PP = TheCompInst->getPreprocessor();
     // adjust PP so that it no longer reports errors, which could happen while trying to
     // parse numbers here
     PP.getDiagnostics().setClient(new IgnoringDiagConsumer(), true);
 
-    for (Preprocessor::macro_iterator it = PP.macro_begin(false),
-                                      end = PP.macro_end(false);
-         it != end; ++it) {
-        const IdentifierInfo *II = it->first;
-#if LLVM_VERSION <= 36
-        MacroDirective *MD = it->second;
-#else
-        MacroDirective *MD = it->second.getLatest();
-#endif
-        AddMacro(T, PP, II, MD, &macros);
+    CompilerInstance **ud =
+            (CompilerInstance **)lua_newuserdata(L, sizeof(CompilerInstance *));
+    *ud = TheCompInst;
+    if (luaL_newmetatable(L, "terra_cmacros")) {
+        lua_pushcfunction(L, freemacros);
+        lua_setfield(L, -2, "__gc");
     }
+    lua_setmetatable(L, -2);
+    lua_pushcclosure(L, lookupmacro, 1);
+    result->setfield("lookupmacro");
+#else
+    delete TheCompInst;
 #endif
+}
 
-    llvm::Module *M = codegen->ReleaseModule();
-    delete codegen;
-    if (!M) {
-        terra_reporterror(T, "compilation of included c code failed\n");
-    }
-    optimizemodule(TT, M);
+static void LinkExternal(terra_State *T, TerraTarget *TT, llvm::Module *M) {
 #if LLVM_VERSION < 39
     char *err;
     if (LLVMLinkModules(llvm::wrap(TT->external), llvm::wrap(M), LLVMLinkerDestroySource,
@@ -1072,44 +1197,49 @@ static int dofile(terra_State *T, TerraTarget *TT, const char *code,
         lua_error(T->L);
     }
 #endif
-    return 0;
 }
 
-int include_c(lua_State *L) {
-    terra_State *T = terra_getstate(L, 1);
-    (void)T;
-    lua_getfield(L, TARGET_POS, "llvm_target");
-    TerraTarget *TT = (TerraTarget *)terra_tocdatapointer(L, -1);
-    const char *code = luaL_checkstring(L, 2);
-    int N = lua_objlen(L, 3);
-    std::vector<const char *> args;
+// clang arguments for TT followed by the user's arguments in the list at argspos
+static void GetClangArgs(lua_State *L, TerraTarget *TT, int argspos,
+                         std::vector<const char *> *args) {
+    int N = lua_objlen(L, argspos);
 
-    args.push_back("-triple");
-    args.push_back(TT->Triple.c_str());
-    args.push_back("-target-cpu");
-    args.push_back(TT->CPU.c_str());
+    args->push_back("-triple");
+    args->push_back(TT->Triple.c_str());
+    args->push_back("-target-cpu");
+    args->push_back(TT->CPU.c_str());
     if (!TT->Features.empty()) {
-        args.push_back("-target-feature");
-        args.push_back(TT->Features.c_str());
+        args->push_back("-target-feature");
+        args->push_back(TT->Features.c_str());
     }
 
 #if defined(_WIN32) && !defined(__MINGW32__)
-    args.push_back("-fms-extensions");
-    args.push_back("-fms-volatile");
-    args.push_back("-fms-compatibility");
-    args.push_back("-fms-compatibility-version=18");
-    args.push_back("-Wno-ignored-attributes");
-    args.push_back("-flto-visibility-public-std");
-    args.push_back("--dependent-lib=msvcrt");
-    args.push_back("-fdiagnostics-format");
-    args.push_back("msvc");
+    args->push_back("-fms-extensions");
+    args->push_back("-fms-volatile");
+    args->push_back("-fms-compatibility");
+    args->push_back("-fms-compatibility-version=18");
+    args->push_back("-Wno-ignored-attributes");
+    args->push_back("-flto-visibility-public-std");
+    args->push_back("--dependent-lib=msvcrt");
+    args->push_back("-fdiagnostics-format");
+    args->push_back("msvc");
 #endif
 
     for (int i = 0; i < N; i++) {
-        lua_rawgeti(L, 3, i + 1);
-        args.push_back(luaL_checkstring(L, -1));
+        lua_rawgeti(L, argspos, i + 1);
+        args->push_back(luaL_checkstring(L, -1));
         lua_pop(L, 1);
     }
+}
+
+int include_c(lua_State *L) {
+    terra_State *T = terra_getstate(L, 1);
+    (void)T;
+    lua_getfield(L, TARGET_POS, "llvm_target");
+    TerraTarget *TT = (TerraTarget *)terra_tocdatapointer(L, -1);
+    const char *code = luaL_checkstring(L, 2);
+    std::vector<const char *> args;
+    GetClangArgs(L, TT, 3, &args);
 
     lua_newtable(L);  // return a table of loaded functions
     int ref_table = lobj_newreftable(L);
@@ -1125,6 +1255,244 @@ int include_c(lua_State *L) {
     return 1;
 }
 
+#if LLVM_VERSION >= 50
+// records what the parser hands to its consumer, so that the Lua tables and the code
+// for a header can be produced once parsing is done, and on a different thread
+class RecordingConsumer : public ASTConsumer {
+public:
+    enum EventKind {
+        TopLevelDecl,
+        InterestingDecl,
+        TagDeclDefinition,
+        CXXImplicitFunctionInstantiation,
+        TopLevelDeclInObjCContainer,
+        TentativeDefinition,
+        CXXStaticMemberVarInstantiation,
+        VTable,
+        ImplicitImportDecl
+    };
+    std::vector<std::pair<EventKind, void *> > events;
+    virtual ~RecordingConsumer() {}
+    virtual bool HandleTopLevelDecl(DeclGroupRef D) {
+        events.push_back(std::make_pair(TopLevelDecl, D.getAsOpaquePtr()));
+        return true;
+    }
+    virtual void HandleInterestingDecl(DeclGroupRef D) {
+        events.push_back(std::make_pair(InterestingDecl, D.getAsOpaquePtr()));
+    }
+    virtual void HandleTagDeclDefinition(TagDecl *D) {
+        events.push_back(std::make_pair(TagDeclDefinition, (void *)D));
+    }
+    virtual void HandleCXXImplicitFunctionInstantiation(FunctionDecl *D) {
+        events.push_back(std::make_pair(CXXImplicitFunctionInstantiation, (void *)D));
+    }
+    virtual void HandleTopLevelDeclInObjCContainer(DeclGroupRef D) {
+        events.push_back(std::make_pair(TopLevelDeclInObjCContainer, D.getAsOpaquePtr()));
+    }
+    virtual void CompleteTentativeDefinition(VarDecl *D) {
+        events.push_back(std::make_pair(TentativeDefinition, (void *)D));
+    }
+    virtual void HandleCXXStaticMemberVarInstantiation(VarDecl *D) {
+        events.push_back(std::make_pair(CXXStaticMemberVarInstantiation, (void *)D));
+    }
+    virtual void HandleVTable(CXXRecordDecl *RD) {
+        events.push_back(std::make_pair(VTable, (void *)RD));
+    }
+    virtual void HandleImplicitImportDecl(ImportDecl *D) {
+        events.push_back(std::make_pair(ImplicitImportDecl, (void *)D));
+    }
+    // what CodeGenProxy does while parsing, split into the part that touches Lua ...
+    void Visit(IncludeCVisitor *Visitor) {
+        for (size_t i = 0; i < events.size(); i++) {
+            if (events[i].first != TopLevelDecl) continue;
+            DeclGroupRef D = DeclGroupRef::getFromOpaquePtr(events[i].second);
+            for (DeclGroupRef::iterator b = D.begin(), e = D.end(); b != e; ++b)
+                Visitor->TraverseDecl(*b);
+        }
+    }
+    // ... and the part that generates code
+    void Replay(CodeGenerator *CG, ASTContext &Ctx, Decl *liveness) {
+        CG->Initialize(Ctx);
+        for (size_t i = 0; i < events.size(); i++) {
+            void *P = events[i].second;
+            switch (events[i].first) {
+                case TopLevelDecl:
+                    CG->HandleTopLevelDecl(DeclGroupRef::getFromOpaquePtr(P));
+                    break;
+                case InterestingDecl:
+                    CG->HandleInterestingDecl(DeclGroupRef::getFromOpaquePtr(P));
+                    break;
+                case TagDeclDefinition:
+                    CG->HandleTagDeclDefinition((TagDecl *)P);
+                    break;
+                case CXXImplicitFunctionInstantiation:
+                    CG->HandleCXXImplicitFunctionInstantiation((FunctionDecl *)P);
+                    break;
+                case TopLevelDeclInObjCContainer:
+                    CG->HandleTopLevelDeclInObjCContainer(DeclGroupRef::getFromOpaquePtr(P));
+                    break;
+                case TentativeDefinition:
+                    CG->CompleteTentativeDefinition((VarDecl *)P);
+                    break;
+                case CXXStaticMemberVarInstantiation:
+                    CG->HandleCXXStaticMemberVarInstantiation((VarDecl *)P);
+                    break;
+                case VTable:
+                    CG->HandleVTable((CXXRecordDecl *)P);
+                    break;
+                case ImplicitImportDecl:
+                    CG->HandleImplicitImportDecl((ImportDecl *)P);
+                    break;
+            }
+        }
+        CG->HandleTopLevelDecl(DeclGroupRef(liveness));
+        CG->HandleTranslationUnit(Ctx);
+    }
+};
+
+struct CIncludeJob {
+    std::string code;
+    std::string livenessfunction;
+    std::unique_ptr<CompilerInstance> CI;
+    RecordingConsumer *consumer;  // owned by CI
+    Decl *liveness;
+    std::string bitcode;  // the optimized module, empty if code generation failed
+};
+
+static void ParseCInclude(terra_State *T, TerraTarget *TT, CIncludeJob *job,
+                          std::vector<const char *> *args, HeaderBroker *broker) {
+    llvm::MemoryBuffer *membuffer =
+            llvm::MemoryBuffer::getMemBuffer(job->code, "<buffer>").release();
+    job->CI.reset(new CompilerInstance());
+    job->CI->getHeaderSearchOpts().ResourceDir = "$CLANG_RESOURCE$";
+    InitHeaderSearchFlags(TT->Triple, job->CI->getHeaderSearchOpts());
+    initializeclang(T, membuffer, &(*args)[0], &(*args)[args->size()], job->CI.get(),
+                    broker);
+    job->consumer = new RecordingConsumer();
+    job->CI->setASTConsumer(std::unique_ptr<ASTConsumer>(job->consumer));
+    job->CI->createSema(clang::TU_Complete, NULL);
+    ParseAST(job->CI->getSema(), false, false);
+}
+
+// generate and optimize the module in a private context, handing it back as bitcode
+static void CodeGenCInclude(TerraTarget *TT, CIncludeJob *job) {
+    llvm::LLVMContext ctx;
+    CompilerInstance &CI = *job->CI;
+    std::unique_ptr<CodeGenerator> codegen(CreateLLVMCodeGen(
+            CI.getDiagnostics(), "mymodule", CI.getHeaderSearchOpts(),
+            CI.getPreprocessorOpts(), CI.getCodeGenOpts(), ctx));
+    job->consumer->Replay(codegen.get(), CI.getASTContext(), job->liveness);
+    std::unique_ptr<llvm::Module> M(codegen->ReleaseModule());
+    if (!M) return;
+    // target machines cache subtargets without locking, so each thread needs its own
+    std::unique_ptr<llvm::TargetMachine> tm(TT->tm->getTarget().createTargetMachine(
+            TT->Triple, TT->CPU, TT->Features, TT->tm->Options,
+            TT->tm->getRelocationModel(), TT->tm->getCodeModel(),
+            CodeGenOpt::Aggressive));
+    optimizemodule(TT, tm.get(), M.get());
+    llvm::raw_string_ostream out(job->bitcode);
+#if LLVM_VERSION >= 70
+    llvm::WriteBitcodeToFile(*M, out);
+#else
+    llvm::WriteBitcodeToFile(M.get(), out);
+#endif
+    out.flush();
+}
+
+template <typename Fn>
+static void RunOnWorkers(size_t njobs, size_t nthreads, Fn fn) {
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < nthreads; t++)
+        workers.push_back(std::thread([&]() {
+            for (size_t i; (i = next++) < njobs;) fn(i);
+        }));
+    for (size_t t = 0; t < nthreads; t++) workers[t].join();
+}
+
+// registercfiles(target, codes, args, headerprovider): like registercfile for each
+// string in codes, but the clang frontends and code generation run on worker threads.
+// the Lua tables are still built here, and the modules are linked in order.
+int include_cmulti(lua_State *L) {
+    terra_State *T = terra_getstate(L, 1);
+    lua_getfield(L, TARGET_POS, "llvm_target");
+    TerraTarget *TT = (TerraTarget *)terra_tocdatapointer(L, -1);
+    std::vector<const char *> args;
+    GetClangArgs(L, TT, 3, &args);
+
+    size_t N = lua_objlen(L, 2);
+    std::vector<std::unique_ptr<CIncludeJob> > jobs;
+    for (size_t i = 0; i < N; i++) {
+        CIncludeJob *job = new CIncludeJob();
+        lua_rawgeti(L, 2, i + 1);
+        job->code = luaL_checkstring(L, -1);
+        lua_pop(L, 1);
+        std::stringstream ss;
+        ss << "__makeeverythinginclanglive_";
+        ss << TT->next_unused_id++;
+        job->livenessfunction = ss.str();
+        job->liveness = NULL;
+        jobs.push_back(std::unique_ptr<CIncludeJob>(job));
+    }
+    size_t nthreads = std::min<size_t>(N, std::max(1u, std::thread::hardware_concurrency()));
+
+    // parse in parallel, answering requests for Lua provided headers on this thread
+    {
+        HeaderBroker broker(nthreads);
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < nthreads; t++)
+            workers.push_back(std::thread([&]() {
+                for (size_t i; (i = next++) < N;)
+                    ParseCInclude(T, TT, jobs[i].get(), &args, &broker);
+                broker.WorkerFinished();
+            }));
+        LuaOverlayFileSystem mainfs(L);
+        broker.Serve(&mainfs);
+        for (size_t t = 0; t < nthreads; t++) workers[t].join();
+    }
+
+    lua_newtable(L);  // return a list of result tables
+    int ref_table = lobj_newreftable(L);
+    // the Lua tables and the liveness functions, which decide what gets generated
+    for (size_t i = 0; i < N; i++) {
+        CIncludeJob *job = jobs[i].get();
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, ref_table - 1, i + 1);
+        Obj result;
+        result.initFromStack(L, ref_table);
+        IncludeCVisitor visitor(&result, TT, job->livenessfunction);
+        visitor.SetContext(&job->CI->getASTContext());
+        job->consumer->Visit(&visitor);
+        job->liveness = visitor.GetLivenessFunction();
+    }
+
+    RunOnWorkers(N, nthreads, [&](size_t i) { CodeGenCInclude(TT, jobs[i].get()); });
+
+    for (size_t i = 0; i < N; i++) {
+        CIncludeJob *job = jobs[i].get();
+        Obj result;
+        lua_rawgeti(L, ref_table - 1, i + 1);
+        result.initFromStack(L, ref_table);
+        AddMacros(T, job->CI.release(), &result);
+        if (job->bitcode.empty())
+            terra_reporterror(T, "compilation of included c code failed\n");
+        llvm::Expected<std::unique_ptr<llvm::Module> > M = llvm::parseBitcodeFile(
+                llvm::MemoryBufferRef(job->bitcode, "mymodule"), *TT->ctx);
+        if (!M) {
+            llvm::consumeError(M.takeError());
+            terra_reporterror(T, "compilation of included c code failed\n");
+        }
+        LinkExternal(T, TT, M->release());
+        jobs[i].reset();
+    }
+
+    lobj_removereftable(L, ref_table);
+    return 1;
+}
+#endif
+
 void terra_cwrapperinit(terra_State *T) {
     lua_getfield(T->L, LUA_GLOBALSINDEX, "terra");
 
@@ -1132,5 +1500,11 @@ void terra_cwrapperinit(terra_State *T) {
     lua_pushcclosure(T->L, include_c, 1);
     lua_setfield(T->L, -2, "registercfile");
 
+#if LLVM_VERSION >= 50
+    lua_pushlightuserdata(T->L, (void *)T);
+    lua_pushcclosure(T->L, include_cmulti, 1);
+    lua_setfield(T->L, -2, "registercfiles");
+#endif
+
     lua_pop(T->L, -1);  // terra object
 }
@@ -12,6 +12,10 @@
 #endif
 #include <ucontext.h>
 #include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <sys/time.h>
 #else
 #ifndef __MINGW32__
 #define NOMINMAX
@@ -27,11 +31,9 @@
 
 using namespace llvm;
 
-#ifdef DEBUG_INFO_WORKING
 static bool pointisbeforeinstruction(uintptr_t point, uintptr_t inst, bool isNextInst) {
     return point < inst || (!isNextInst && point == inst);
 }
-#endif
 static bool stacktrace_findline(terra_CompilerState *C, const TerraFunctionInfo *fi,
                                 uintptr_t ip, bool isNextInstr, StringRef *file,
                                 size_t *lineno) {
@@ -54,7 +56,16 @@ static bool stacktrace_findline(terra_CompilerState *C, const TerraFunctionInfo
         return false;
     }
 #else
-    return false;
+    // the line table read from the DWARF of the function's object in debug mode
+    const std::vector<TerraLineStart> &lines = fi->lines;
+    size_t i;
+    for (i = 0; i < lines.size() && pointisbeforeinstruction(lines[i].addr, ip, isNextInstr);
+         i++) {
+    }
+    if (i == 0) return false;
+    if (lineno) *lineno = lines[i - 1].line;
+    if (file) *file = lines[i - 1].file;
+    return true;
 #endif
 }
 
@@ -151,6 +162,24 @@ static bool printfunctioninfo(terra_CompilerState *C, uintptr_t ip, bool isNextI
     return false;
 }
 
+#ifndef _WIN32
+static void getcontextregisters(void *uap, void **rip, void **rbp) {
+    ucontext_t *uc = (ucontext_t *)uap;
+#ifdef __linux__
+    *rip = (void *)uc->uc_mcontext.gregs[REG_RIP];
+    *rbp = (void *)uc->uc_mcontext.gregs[REG_RBP];
+#else
+#ifdef __FreeBSD__
+    *rip = (void *)uc->uc_mcontext.mc_rip;
+    *rbp = (void *)uc->uc_mcontext.mc_rbp;
+#else
+    *rip = (void *)uc->uc_mcontext->__ss.__rip;
+    *rbp = (void *)uc->uc_mcontext->__ss.__rbp;
+#endif
+#endif
+}
+#endif
+
 static void printstacktrace(void *uap, void *data) {
     terra_CompilerState *C = (terra_CompilerState *)data;
     const int maxN = 128;
@@ -163,19 +192,7 @@ static void printstacktrace(void *uap, void *data) {
         rip = __builtin_return_address(0);
         rbp = __builtin_frame_address(1);
     } else {
-        ucontext_t *uc = (ucontext_t *)uap;
-#ifdef __linux__
-        rip = (void *)uc->uc_mcontext.gregs[REG_RIP];
-        rbp = (void *)uc->uc_mcontext.gregs[REG_RBP];
-#else
-#ifdef __FreeBSD__
-        rip = (void *)uc->uc_mcontext.mc_rip;
-        rbp = (void *)uc->uc_mcontext.mc_rbp;
-#else
-        rip = (void *)uc->uc_mcontext->__ss.__rip;
-        rbp = (void *)uc->uc_mcontext->__ss.__rbp;
-#endif
-#endif
+        getcontextregisters(uap, &rip, &rbp);
     }
 #else
     if (uap == NULL) {
@@ -259,6 +276,150 @@ static bool terra_lookupline(void *fnaddr, void *ip, LineInfo *r,
     return true;
 }
 
+#ifndef _WIN32
+// sampling profiler: a SIGPROF handler records raw backtraces into preallocated
+// buffers, and they are only resolved to Terra functions and lines once sampling stops
+
+#define PROFILE_MAX_DEPTH 64
+
+struct ProfileState {
+    void **frames;  // maxsamples x PROFILE_MAX_DEPTH return addresses
+    int *depths;
+    volatile sig_atomic_t nsamples;
+    int maxsamples;
+    volatile sig_atomic_t dropped;
+    bool running;
+    struct sigaction oldaction;
+    struct itimerval oldtimer;
+};
+static ProfileState profilestate;
+
+static void profile_sample(int sig, siginfo_t *info, void *uap) {
+    int olderrno = errno;  // terra_backtrace probes memory with write()
+    int i = profilestate.nsamples;
+    if (i < profilestate.maxsamples) {
+        void *rip, *rbp;
+        getcontextregisters(uap, &rip, &rbp);
+        profilestate.depths[i] = terra_backtrace(&profilestate.frames[i * PROFILE_MAX_DEPTH],
+                                                 PROFILE_MAX_DEPTH, rip, rbp);
+        profilestate.nsamples = i + 1;
+    } else {
+        profilestate.dropped++;
+    }
+    errno = olderrno;
+}
+
+static int terra_profilerstart(lua_State *L) {
+    int interval = luaL_checkint(L, 1);  // microseconds of cpu time between samples
+    int maxsamples = luaL_checkint(L, 2);
+    if (profilestate.running) luaL_error(L, "profiler is already running");
+    if (interval <= 0 || maxsamples <= 0)
+        luaL_error(L, "profiler interval and sample count must be positive");
+    profilestate.frames = (void **)malloc(sizeof(void *) * maxsamples * PROFILE_MAX_DEPTH);
+    profilestate.depths = (int *)malloc(sizeof(int) * maxsamples);
+    if (!profilestate.frames || !profilestate.depths) {
+        free(profilestate.frames);
+        free(profilestate.depths);
+        luaL_error(L, "profiler: out of memory for %d samples", maxsamples);
+    }
+    profilestate.nsamples = 0;
+    profilestate.dropped = 0;
+    profilestate.maxsamples = maxsamples;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = profile_sample;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, &profilestate.oldaction);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = interval / 1000000;
+    timer.it_interval.tv_usec = interval % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, &profilestate.oldtimer);
+    profilestate.running = true;
+    return 0;
+}
+
+static void resolveprofileframe(lua_State *L, terra_CompilerState *C, uintptr_t ip,
+                                bool isNextInst) {
+    lua_newtable(L);
+    const TerraFunctionInfo *fi;
+    if (stacktrace_findsymbol(C, ip, &fi)) {
+        StringRef name = fi->name;
+        if (name.startswith("$")) name = name.substr(1);
+        lua_pushlstring(L, name.data(), name.size());
+        lua_setfield(L, -2, "name");
+        lua_pushstring(L, "terra");
+        lua_setfield(L, -2, "kind");
+        StringRef filename;
+        size_t lineno;
+        if (stacktrace_findline(C, fi, ip, isNextInst, &filename, &lineno)) {
+            lua_pushlstring(L, filename.data(), filename.size());
+            lua_setfield(L, -2, "file");
+            lua_pushnumber(L, lineno);
+            lua_setfield(L, -2, "line");
+        }
+    } else {
+        Dl_info info;
+        bool found = dladdr((void *)ip, &info) != 0;
+        if (found && info.dli_sname)
+            lua_pushstring(L, info.dli_sname);
+        else if (found && info.dli_fname)
+            lua_pushfstring(L, "[%s]", info.dli_fname);
+        else
+            lua_pushfstring(L, "%p", (void *)ip);
+        lua_setfield(L, -2, "name");
+        lua_pushstring(L, "C");
+        lua_setfield(L, -2, "kind");
+    }
+}
+
+// stops sampling and returns { locations = { {name,kind,file,line} ... },
+// samples = { {innermost location index, ..., outermost}, ... }, dropped = N }
+static int terra_profilerstop(lua_State *L) {
+    terra_State *T = terra_getstate(L, 1);
+    if (!profilestate.running) luaL_error(L, "profiler is not running");
+    setitimer(ITIMER_PROF, &profilestate.oldtimer, NULL);
+    sigaction(SIGPROF, &profilestate.oldaction, NULL);
+    profilestate.running = false;
+
+    lua_newtable(L);
+    lua_newtable(L);  // locations
+    lua_newtable(L);  // samples
+    DenseMap<std::pair<void *, int>, int> locationids;
+    int nlocations = 0;
+    for (int i = 0; i < profilestate.nsamples; i++) {
+        void **frames = &profilestate.frames[i * PROFILE_MAX_DEPTH];
+        lua_createtable(L, profilestate.depths[i], 0);
+        for (int j = 0; j < profilestate.depths[i]; j++) {
+            // only the interrupted frame points at the instruction itself, the rest are
+            // return addresses
+            std::pair<void *, int> key(frames[j], j > 0);
+            int &id = locationids[key];
+            if (id == 0) {
+                id = ++nlocations;
+                resolveprofileframe(L, T->C, (uintptr_t)frames[j], j > 0);
+                lua_rawseti(L, -4, id);
+            }
+            lua_pushnumber(L, id);
+            lua_rawseti(L, -2, j + 1);
+        }
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -3, "samples");
+    lua_setfield(L, -2, "locations");
+    lua_pushnumber(L, profilestate.dropped);
+    lua_setfield(L, -2, "dropped");
+    free(profilestate.frames);
+    free(profilestate.depths);
+    profilestate.frames = NULL;
+    profilestate.depths = NULL;
+    return 1;
+}
+#endif
+
 #define CLOSURE_MAX_SIZE 64
 
 static void *createclosure(uint8_t *buf, void *fn, int nargs, void **env, int nenv) {
@@ -309,6 +470,13 @@ int terra_debuginit(struct terra_State *T) {
     lua_pushlightuserdata(T->L, (void *)lookupline);
     lua_pushlightuserdata(T->L, (void *)llvmutil_disassemblefunction);
     lua_call(T->L, 5, 0);
+#ifndef _WIN32
+    lua_pushcfunction(T->L, terra_profilerstart);
+    lua_setfield(T->L, -2, "profilerstart");
+    lua_pushlightuserdata(T->L, (void *)T);
+    lua_pushcclosure(T->L, terra_profilerstop, 1);
+    lua_setfield(T->L, -2, "profilerstop");
+#endif
     lua_pop(T->L, 1); /* terra table */
     return 0;
 }
@@ -15,6 +15,8 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <stddef.h>
+#include <string>
 #ifndef _WIN32
 #include <dlfcn.h>
 #include <libgen.h>
@@ -146,6 +148,268 @@ int terra_lualoadstring(lua_State *L) {
     return 1;
 }
 
+// serialization of parsed trees for the module cache. Values are written with a tag
+// byte; tables and functions are numbered in the order they are first written so
+// shared references (and cycles) are preserved. Metatables are written as indices into
+// a list of classes supplied by the caller. Functions are saved as bytecode, so only
+// functions without upvalues can be serialized.
+
+enum {
+    TREE_NIL,
+    TREE_FALSE,
+    TREE_TRUE,
+    TREE_NUMBER,
+    TREE_STRING,
+    TREE_TABLE,
+    TREE_FUNCTION,
+    TREE_REF,
+    TREE_END
+};
+
+struct TreeWriter {
+    lua_State *L;
+    int classes;  // table mapping metatables to their index
+    int seen;     // table mapping tables/functions to their index
+    int nseen;
+    std::string out;
+    const char *err;
+};
+
+static void tw_u32(TreeWriter *w, uint32_t v) { w->out.append((const char *)&v, 4); }
+
+static int tw_dumpwriter(lua_State *L, const void *p, size_t sz, void *ud) {
+    ((std::string *)ud)->append((const char *)p, sz);
+    return 0;
+}
+
+static bool tw_value(TreeWriter *w, int idx) {
+    lua_State *L = w->L;
+    if (!lua_checkstack(L, 8)) {
+        w->err = "trees are nested too deeply";
+        return false;
+    }
+    switch (lua_type(L, idx)) {
+        case LUA_TNIL:
+            w->out.push_back(TREE_NIL);
+            return true;
+        case LUA_TBOOLEAN:
+            w->out.push_back(lua_toboolean(L, idx) ? TREE_TRUE : TREE_FALSE);
+            return true;
+        case LUA_TNUMBER: {
+            double d = lua_tonumber(L, idx);
+            w->out.push_back(TREE_NUMBER);
+            w->out.append((const char *)&d, sizeof(d));
+            return true;
+        }
+        case LUA_TSTRING: {
+            size_t len;
+            const char *str = lua_tolstring(L, idx, &len);
+            w->out.push_back(TREE_STRING);
+            tw_u32(w, (uint32_t)len);
+            w->out.append(str, len);
+            return true;
+        }
+        case LUA_TTABLE:
+        case LUA_TFUNCTION:
+            break;
+        default:
+            w->err = "trees contain a value that cannot be saved";
+            return false;
+    }
+    lua_pushvalue(L, idx);
+    lua_rawget(L, w->seen);
+    if (!lua_isnil(L, -1)) {
+        w->out.push_back(TREE_REF);
+        tw_u32(w, (uint32_t)lua_tointeger(L, -1));
+        lua_pop(L, 1);
+        return true;
+    }
+    lua_pop(L, 1);
+    lua_pushvalue(L, idx);
+    lua_pushinteger(L, ++w->nseen);
+    lua_rawset(L, w->seen);
+
+    if (lua_isfunction(L, idx)) {
+        if (lua_iscfunction(L, idx) || lua_getupvalue(L, idx, 1) != NULL) {
+            w->err = "trees contain a function with upvalues";
+            return false;
+        }
+        std::string code;
+        lua_pushvalue(L, idx);
+        lua_dump(L, tw_dumpwriter, &code);
+        lua_pop(L, 1);
+        w->out.push_back(TREE_FUNCTION);
+        tw_u32(w, (uint32_t)code.size());
+        w->out.append(code);
+        return true;
+    }
+
+    uint32_t cls = 0;
+    if (lua_getmetatable(L, idx)) {
+        lua_rawget(L, w->classes);
+        if (lua_isnil(L, -1)) {
+            w->err = "trees contain a table with an unknown metatable";
+            return false;
+        }
+        cls = (uint32_t)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+    }
+    w->out.push_back(TREE_TABLE);
+    tw_u32(w, cls);
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+        int top = lua_gettop(L);
+        if (!tw_value(w, top - 1) || !tw_value(w, top)) return false;
+        lua_pop(L, 1);
+    }
+    w->out.push_back(TREE_END);
+    return true;
+}
+
+// serializetrees(value,classes) -> string or nil,errormessage
+// classes maps each metatable that may appear in value to a positive integer
+static int terra_serializetrees(lua_State *L) {
+    lua_settop(L, 2);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_newtable(L);
+    TreeWriter w;
+    w.L = L;
+    w.classes = 2;
+    w.seen = 3;
+    w.nseen = 0;
+    w.err = NULL;
+    if (!tw_value(&w, 1)) {
+        lua_pushnil(L);
+        lua_pushstring(L, w.err);
+        return 2;
+    }
+    lua_pushlstring(L, w.out.data(), w.out.size());
+    return 1;
+}
+
+struct TreeReader {
+    lua_State *L;
+    int classes;  // list of metatables
+    int refs;     // list of tables/functions read so far
+    int nrefs;
+    const char *cur, *end;
+    const char *chunkname;
+};
+
+static bool tr_u32(TreeReader *r, uint32_t *v) {
+    if (r->end - r->cur < 4) return false;
+    memcpy(v, r->cur, 4);
+    r->cur += 4;
+    return true;
+}
+
+// pushes the value read, or returns false if the data is malformed
+static bool tr_value(TreeReader *r) {
+    lua_State *L = r->L;
+    if (r->cur == r->end || !lua_checkstack(L, 8)) return false;
+    int tag = *r->cur++;
+    switch (tag) {
+        case TREE_NIL:
+            lua_pushnil(L);
+            return true;
+        case TREE_FALSE:
+        case TREE_TRUE:
+            lua_pushboolean(L, tag == TREE_TRUE);
+            return true;
+        case TREE_NUMBER: {
+            double d;
+            if (r->end - r->cur < (ptrdiff_t)sizeof(d)) return false;
+            memcpy(&d, r->cur, sizeof(d));
+            r->cur += sizeof(d);
+            lua_pushnumber(L, d);
+            return true;
+        }
+        case TREE_STRING:
+        case TREE_FUNCTION: {
+            uint32_t len;
+            if (!tr_u32(r, &len) || (uint32_t)(r->end - r->cur) < len) return false;
+            if (tag == TREE_STRING) {
+                lua_pushlstring(L, r->cur, len);
+            } else {
+                if (luaL_loadbuffer(L, r->cur, len, r->chunkname)) return false;
+                lua_pushvalue(L, -1);
+                lua_rawseti(L, r->refs, ++r->nrefs);
+            }
+            r->cur += len;
+            return true;
+        }
+        case TREE_REF: {
+            uint32_t id;
+            if (!tr_u32(r, &id) || id == 0 || id > (uint32_t)r->nrefs) return false;
+            lua_rawgeti(L, r->refs, id);
+            return true;
+        }
+        case TREE_TABLE: {
+            uint32_t cls;
+            if (!tr_u32(r, &cls)) return false;
+            lua_newtable(L);
+            int t = lua_gettop(L);
+            lua_pushvalue(L, t);
+            lua_rawseti(L, r->refs, ++r->nrefs);
+            while (r->cur != r->end && *r->cur != TREE_END) {
+                if (!tr_value(r) || !tr_value(r) || lua_isnil(L, -2)) return false;
+                lua_rawset(L, t);
+            }
+            if (r->cur == r->end) return false;
+            r->cur++;
+            if (cls != 0) {
+                lua_rawgeti(L, r->classes, cls);
+                if (!lua_istable(L, -1)) return false;
+                lua_setmetatable(L, t);
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// deserializetrees(string,classes[,chunkname]) -> value or nil,errormessage
+// classes is the list of metatables whose indices were given to serializetrees
+static int terra_deserializetrees(lua_State *L) {
+    size_t len;
+    const char *data = luaL_checklstring(L, 1, &len);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    const char *chunkname = luaL_optstring(L, 3, "=(trees)");
+    lua_settop(L, 3);
+    lua_newtable(L);
+    TreeReader r;
+    r.L = L;
+    r.classes = 2;
+    r.refs = 4;
+    r.nrefs = 0;
+    r.cur = data;
+    r.end = data + len;
+    r.chunkname = chunkname;
+    if (!tr_value(&r) || r.cur != r.end) {
+        lua_settop(L, 4);
+        lua_pushnil(L);
+        lua_pushstring(L, "malformed tree data");
+        return 2;
+    }
+    return 1;
+}
+
+// hashstring(str) -> 64-bit FNV-1a hash of str as a hex string
+static int terra_hashstring(lua_State *L) {
+    size_t len;
+    const unsigned char *str = (const unsigned char *)luaL_checklstring(L, 1, &len);
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= str[i];
+        h *= 1099511628211ULL;
+    }
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%08x%08x", (unsigned)(h >> 32), (unsigned)h);
+    lua_pushstring(L, buf);
+    return 1;
+}
+
 int terra_loadandrunbytecodes(lua_State *L, const unsigned char *bytecodes, size_t size,
                               const char *name) {
     return luaL_loadbuffer(L, (const char *)bytecodes, size, name) ||
@@ -209,6 +473,12 @@ int terra_initwithoptions(lua_State *L, terra_Options *options) {
     lua_setfield(T->L, -2, "loadstring");
     lua_pushcfunction(T->L, terra_lualoadfile);
     lua_setfield(T->L, -2, "loadfile");
+    lua_pushcfunction(T->L, terra_serializetrees);
+    lua_setfield(T->L, -2, "serializetrees");
+    lua_pushcfunction(T->L, terra_deserializetrees);
+    lua_setfield(T->L, -2, "deserializetrees");
+    lua_pushcfunction(T->L, terra_hashstring);
+    lua_setfield(T->L, -2, "hashstring");
 
     lua_pushstring(T->L, TERRA_VERSION_STRING);
     lua_setfield(T->L, -2, "version");
@@ -220,6 +490,8 @@ int terra_initwithoptions(lua_State *L, terra_Options *options) {
     lua_setfield(L, -2, "isverbose");
     lua_pushinteger(L, T->options.debug);
     lua_setfield(L, -2, "isdebug");
+    lua_pushinteger(L, T->options.perf);
+    lua_setfield(L, -2, "isperf");
 
     terra_registerinternalizedfiles(L, -1);
     lua_pop(T->L, 1);  //'terra' global
@@ -242,6 +514,7 @@ static int terra_free(lua_State *L) {
     for (TerraTarget *TT : T->targets) {
         freetarget(TT);
     }
+    luaS_free(T);
     return 0;
 }
 
@@ -343,6 +616,7 @@ extern "C" int luaopen_terra(lua_State *L) {
     if (!lua_isnil(L, 1)) options.verbose = lua_tonumber(L, 1);
     if (!lua_isnil(L, 2)) options.debug = lua_tonumber(L, 2);
     if (!lua_isnil(L, 3)) options.usemcjit = lua_tonumber(L, 3);
+    if (!lua_isnil(L, 4)) options.perf = lua_tonumber(L, 4);
     if (terra_initwithoptions(L, &options)) lua_error(L);
     return 0;
 }
@@ -416,14 +416,17 @@ local function findfirstnilstackframe() --because stack size is not exposed we b
     return high - 1 --don't count ourselves
 end
 
+local function speculativeerror(err) return err end
+
 --all calls to user-defined functions from the compiler go through this wrapper
+--if speculate is "quiet" the caller will not report the error, so it is returned without a traceback
 local function invokeuserfunction(anchor, what, speculate, userfn,  ...)
     if not speculate then
         local result = userfn(...)
         -- invokeuserfunction is recognized by a customtraceback and we need to prevent the tail call
         return result
     end
-    local success,result = xpcall(userfn,debug.traceback,...)
+    local success,result = xpcall(userfn,speculate == "quiet" and speculativeerror or debug.traceback,...)
     -- same here
     return success, result
 end
@@ -494,6 +497,10 @@ function T.globalvalue:gettype() return self.type end
 function T.globalvalue:getname() return self.name end
 function T.globalvalue:setname(name) self.name = tostring(name) return self end
 
+-- for each global value, the functions whose definitions use it (weak in both directions),
+-- so that redefining a compiled function only recompiles the functions that can refer to it
+local dependents = setmetatable({},{__mode = "k"})
+
 local function readytocompile(root)
     local visited = {}
     local function visit(gv)
@@ -506,6 +513,8 @@ local function readytocompile(root)
             gv.type:completefunction()
             if gv.definition.kind == "functiondef" then
                 for i,g in ipairs(gv.definition.globalsused) do
+                    dependents[g] = dependents[g] or setmetatable({},{__mode = "k"})
+                    dependents[g][gv] = true
                     visit(g)
                 end
             end
@@ -519,6 +528,52 @@ local function readytocompile(root)
         g.readytocompile = true
     end
 end
+-- root has been given a new definition after it was compiled. root and everything that
+-- transitively uses it may have inlined the old code, so they get fresh definition
+-- objects (forcing them to be emitted again) and, if they were already JIT compiled,
+-- new code. the old entry points are redirected to the new code for anyone still
+-- holding a pointer to them; returns the list of functions whose old code may still
+-- run: those whose entry points could not be redirected, and those that callers
+-- compiled earlier reached through an internal entry that is not redirected.
+-- rootdefinition is the definition root had when it was compiled.
+local function invalidate(root,rootdefinition)
+    local stale,visited = List(),{}
+    local function visit(gv)
+        if visited[gv] then return end
+        visited[gv] = true
+        stale:insert(gv)
+        for d,_ in pairs(dependents[gv] or {}) do
+            visit(d)
+        end
+    end
+    visit(root)
+    local internalentry = {}
+    for i,gv in ipairs(stale) do
+        gv.readytocompile = nil
+        internalentry[gv] = (gv == root and rootdefinition or gv.definition).internalentry
+        if gv ~= root then
+            local d = copyobject(gv.definition,{})
+            for k,v in pairs(gv.definition) do
+                if rawget(d,k) == nil then d[k] = v end
+            end
+            gv.definition = d
+        end
+    end
+    local unredirected = List()
+    for i,gv in ipairs(stale) do
+        local old = gv.rawjitptr
+        gv.rawjitptr,gv.ffiwrapper = nil,nil
+        if old then
+            local new = gv:compile()
+            local redirected = new == old or terra.redirectfunction(old,new)
+            if not redirected or internalentry[gv] then
+                unredirected:insert(gv)
+            end
+        end
+    end
+    return unredirected
+end
+
 function T.globalvalue:checkreadytocompile()
     if not self.readytocompile then
         readytocompile(self)
@@ -531,6 +586,27 @@ function T.globalvalue:compile()
     end
     return self.rawjitptr
 end
+-- compiles the functions and globals in values together, so that the JIT creates one
+-- object for all of them rather than one each; returns the list of their raw pointers
+function terra.compile(values)
+    local todo = List()
+    for i,v in ipairs(values) do
+        if not T.globalvalue:isclassof(v) then
+            error("expected terra global or function but found "..terra.type(v),2)
+        end
+        if not v.rawjitptr then todo:insert(v) end
+    end
+    if #todo > 0 then
+        local ptrs,elapsed = terra.jitcompilationunit:jitvalues(todo)
+        for i,v in ipairs(todo) do
+            v.stats = v.stats or {}
+            v.rawjitptr,v.stats.jit = ptrs[i],elapsed / #todo
+        end
+    end
+    local results = List()
+    for i,v in ipairs(values) do results[i] = v.rawjitptr end
+    return results
+end
 function T.globalvalue:getpointer()
     if not self.ffiwrapper then
         local rawptr = self:compile()
@@ -560,6 +636,93 @@ function T.terrafunction:setnoreturn(v)
     assert(self:isdefined(), "attempting to set the noreturn state of an undefined function")
     self.definition.noreturn = not not v
 end
+-- callers of a redefinable function always go through the entry point that
+-- resetdefinition redirects, and on x86-64 it starts with room for the jump
+function T.terrafunction:setredefinable(v)
+    assert(self:isdefined(), "attempting to set the redefinable state of an undefined function")
+    self.definition.redefinable = not not v
+end
+local optlevels = { O0 = true, O1 = true, O2 = true, O3 = true, Os = true }
+local function checkoptlevel(level)
+    if not optlevels[level] then
+        error("expected an optimization level (O0, O1, O2, O3 or Os) but found "..tostring(level),3)
+    end
+end
+-- overrides the optimization level of the compilation unit for this function
+function T.terrafunction:setoptlevel(level)
+    assert(self:isdefined(), "attempting to set the optimization level of an undefined function")
+    checkoptlevel(level)
+    self.definition.optlevel = level
+end
+-- marks pointer parameters (by name or position) noalias, like C's restrict
+function T.terrafunction:setnoalias(...)
+    assert(self:isdefined(), "attempting to set the noalias parameters of an undefined function")
+    local parameters,noalias = self.definition.parameters,List()
+    for _,p in ipairs({...}) do
+        local index = type(p) == "number" and p
+        for i,param in ipairs(parameters) do
+            if param.name == p then index = i end
+        end
+        local param = index and parameters[index]
+        if not param then error("unknown parameter "..tostring(p),2) end
+        if not param.type:ispointer() then
+            error("noalias parameter "..param.name.." must be a pointer but has type "..tostring(param.type),2)
+        end
+        noalias:insert(index)
+    end
+    self.definition.noalias = noalias
+end
+-- setattributes{...} sets several attributes at once: the ones with their own setter go
+-- through it, the others are stored on the definition for the compiler
+local attributesetters = { inline = T.terrafunction.setinlined, optimize = T.terrafunction.setoptimized,
+                           noreturn = T.terrafunction.setnoreturn, optlevel = T.terrafunction.setoptlevel,
+                           redefinable = T.terrafunction.setredefinable }
+local attributetypes = { hot = "boolean", cold = "boolean", minsize = "boolean", align = "number",
+                         targetcpu = "string", targetfeatures = "string" }
+local function ispowerof2(n)
+    while n > 1 and n % 2 == 0 do n = n / 2 end
+    return n == 1
+end
+function T.terrafunction:setattributes(attributes)
+    assert(self:isdefined(), "attempting to set the attributes of an undefined function")
+    if type(attributes) ~= "table" then
+        error("attributes must be a table, not a " .. type(attributes),2)
+    end
+    -- check everything before changing anything, so that a bad table leaves the
+    -- function as it was
+    for k,v in pairs(attributes) do
+        local typ = attributetypes[k]
+        if k == "optlevel" then
+            checkoptlevel(v)
+        elseif attributesetters[k] then -- any value is accepted as a boolean
+        elseif not typ then
+            error("unknown function attribute "..tostring(k),2)
+        elseif type(v) ~= typ then
+            error("function attribute "..k.." must be a "..typ.." but found "..type(v),2)
+        elseif k == "align" and not ispowerof2(v) then
+            error("function alignment must be a power of two but found "..v,2)
+        end
+    end
+    local function after(k,field,convert)
+        if attributes[k] == nil then return self.definition[field] end
+        return convert(attributes[k])
+    end
+    local function istrue(v) return not not v end
+    if after("hot","hot",istrue) and after("cold","cold",istrue) then
+        error("a function cannot be both hot and cold",2)
+    end
+    if after("inline","alwaysinline",istrue) and after("optimize","dontoptimize",function(v) return not v end) then
+        error("setinlined(true) and setoptimized(false) are incompatible",2)
+    end
+    for k,v in pairs(attributes) do
+        local setter = attributesetters[k]
+        if setter then
+            setter(self,v)
+        else
+            self.definition[k] = v
+        end
+    end
+end
 function T.terrafunction:disas()
     print("definition ", self:gettype())
     terra.disassemble(terra.jitcompilationunit:addvalue(self),self:compile())
@@ -588,11 +751,18 @@ function T.terrafunction:resetdefinition(functiondef)
         functiondef = functiondef.definition
     end
     assert(T.definition:isclassof(functiondef), "expected a defined terra function")
-    if self.readytocompile then error("cannot reset a definition of function that has already been compiled",2) end
     if self.type ~= functiondef.type and self.type ~= terra.types.placeholderfunction then
         error(("attempting to define terra function declaration with type %s with a terra function definition of type %s"):format(tostring(self.type),tostring(functiondef.type)))
     end
+    local olddefinition = self.definition
+    if olddefinition and olddefinition.redefinable then
+        functiondef.redefinable = true -- callers compiled earlier rely on it
+    end
     self.definition,self.type,functiondef.name = functiondef,functiondef.type,assert(self.name)
+    if self.readytocompile then
+        return invalidate(self,olddefinition)
+    end
+    return List()
 end
 function T.terrafunction:gettype(nop)
     assert(nop == nil, ":gettype no longer takes any callbacks for when a function is complete")
@@ -768,31 +938,80 @@ end
 -- COMPILATION UNIT
 local compilationunit = {}
 compilationunit.__index = compilationunit
+-- default for new compilation units: emit C-style type-based alias analysis metadata
+terra.strictaliasing = false
+-- default for new compilation units: the optimization level of functions and of saveobj
+terra.optlevel = "O3"
+-- defaults for new compilation units: pack JIT code of separately compiled functions into
+-- shared pages, and put it on 2MB pages
+terra.jitcompactcode = false
+terra.jithugepages = false
 function terra.newcompilationunit(target,opt)
     assert(terra.istarget(target),"expected a target object")
     return setmetatable({ symbols = newweakkeytable(),
+                          types = {}, -- the types whose layouts the compiler caches by address, kept alive
                           collectfunctions = opt,
+                          strictaliasing = terra.strictaliasing,
+                          optlevel = terra.optlevel,
+                          compactcode = terra.jitcompactcode,
+                          hugepages = terra.jithugepages,
                           llvm_cu = cdatawithdestructor(terra.initcompilationunit(target.llvm_target,opt),terra.freecompilationunit) },compilationunit) -- mapping from Types,Functions,Globals,Constants -> llvm value associated with them for this compilation
 end
 function compilationunit:addvalue(k,v)
     if type(k) ~= "string" then k,v = nil,k end
     v:checkreadytocompile()
+    checkoptlevel(self.optlevel)
     return terra.compilationunitaddvalue(self,k,v)
 end
 function compilationunit:jitvalue(v)
     local gv = self:addvalue(v)
     return terra.jit(self.llvm_cu,gv)
 end
+function compilationunit:jitvalues(values)
+    local gvs = List()
+    for i,v in ipairs(values) do gvs[i] = self:addvalue(v) end
+    return terra.jitbatch(self.llvm_cu,gvs)
+end
 function compilationunit:free()
     assert(not self.collectfunctions, "cannot explicitly release a compilation unit with auto-delete functions")
     ffi.gc(self.llvm_cu,nil) --unregister normal destructor object
     terra.freecompilationunit(self.llvm_cu)
 end
 function compilationunit:dump() terra.dumpmodule(self.llvm_cu) end
+function compilationunit:jitmemoryreport() return terra.jitmemoryreport(self.llvm_cu) end
+function compilationunit:memoryreport() return terra.memoryreport(self.llvm_cu) end
+function compilationunit:printmemoryreport()
+    io.write(("%-24s %10s %12s %14s %12s\n"):format("module","functions","definitions","instructions","bytes"))
+    for i,m in ipairs(self:memoryreport()) do
+        local name = m.name ~= "" and m.name or "<string>"
+        io.write(("%-24s %10d %12d %14d %12s\n"):format(name,m.functions,m.definitions,m.instructions,m.bytes and tostring(m.bytes) or "lazy"))
+    end
+    local jit = self:jitmemoryreport()
+    if jit then
+        io.write(("\n%-24s %10s %12s %14s %12s\n"):format("jit memory","regions","reserved","used","allocated"))
+        for _,kind in ipairs {"code","rodata","rwdata"} do
+            local r = jit[kind]
+            io.write(("%-24s %10d %12d %14d %12d\n"):format(kind,r.regions,r.reserved,r.used,r.allocated))
+        end
+        io.write(("%d protection changes\n"):format(jit.protections))
+    end
+end
 
-terra.nativetarget = terra.newtarget {}
---terra.cudatarget = terra.newtarget {Triple = 'nvptx64-nvidia-cuda', FloatABIHard = true}
-terra.jitcompilationunit = terra.newcompilationunit(terra.nativetarget,true) -- compilation unit used for JIT compilation, will eventually specify the native architecture
+-- creating a target initializes LLVM, so the native target and the JIT compilation unit
+-- are created the first time they are used rather than when terralib is loaded
+local lazyterrafields = {
+    nativetarget = function() return terra.newtarget {} end,
+    --cudatarget = function() return terra.newtarget {Triple = 'nvptx64-nvidia-cuda', FloatABIHard = true} end,
+    jitcompilationunit = function() return terra.newcompilationunit(terra.nativetarget,true) end, -- compilation unit used for JIT compilation, will eventually specify the native architecture
+}
+setmetatable(terra, { __index = function(self,k)
+    local create = lazyterrafields[k]
+    if create then
+        local v = create()
+        rawset(self,k,v)
+        return v
+    end
+end })
 
 terra.llvm_gcdebugmetatable = { __gc = function(obj)
     print("GC IS CALLED")
@@ -2011,6 +2230,10 @@ function typecheck(topexp,luaenv,simultaneousdefinitions)
     local env = terra.newenvironment(luaenv or {})
     local diag = terra.newdiagnostics()
     simultaneousdefinitions = simultaneousdefinitions or {}
+    --__cast metamethods that failed while speculating during this typecheck, indexed by
+    --metamethod, then expression, then the type it was cast to. overload resolution
+    --tries the same argument against each definition, so it does not retry them
+    local rejectedcasts = {}
 
     local invokeuserfunction = function(...)
         diag:finishandabortiferrors("Errors reported during typechecking.",2)
@@ -2244,16 +2467,26 @@ function typecheck(topexp,luaenv,simultaneousdefinitions)
 
             local errormsgs = terra.newlist()
             for i,__cast in ipairs(cast_fns) do
-                local quotedexp = terra.newquote(exp)
-                local success,result = invokeuserfunction(exp, "invoking __cast", true,__cast,exp.type,typ,quotedexp)
-                if success then
-                    local result = asterraexpression(exp,result)
-                    if result.type ~= typ then
-                        diag:reporterror(exp,"user-defined cast returned expression with the wrong type.")
+                local rejected = speculative and rejectedcasts[__cast]
+                rejected = rejected and rejected[exp]
+                if not (rejected and rejected[typ]) then
+                    local quotedexp = terra.newquote(exp)
+                    local success,result = invokeuserfunction(exp, "invoking __cast", speculative and "quiet" or true,__cast,exp.type,typ,quotedexp)
+                    if success then
+                        local result = asterraexpression(exp,result)
+                        if result.type ~= typ then
+                            diag:reporterror(exp,"user-defined cast returned expression with the wrong type.")
+                        end
+                        return result,true
+                    else
+                        errormsgs:insert(result)
+                        if speculative then
+                            local byexp = rejectedcasts[__cast] or {}
+                            rejectedcasts[__cast] = byexp
+                            byexp[exp] = byexp[exp] or {}
+                            byexp[exp][typ] = true
+                        end
                     end
-                    return result,true
-                else
-                    errormsgs:insert(result)
                 end
             end
 
@@ -2834,209 +3067,232 @@ function typecheck(topexp,luaenv,simultaneousdefinitions)
         end
         return asterraexpression(e, value, location)
     end
-    function checkexp(e_, location)
-        location = location or "expression"
-        assert(type(location) == "string")
-        local function docheck(e)
-            if not terra.istree(e) then
-                print("not a tree?")
-                print(debug.traceback())
-                terra.printraw(e)
-            end
-            if e:is "literal" then
-                return e
-            elseif e:is "var" then
-                local v = env:combinedenv()[e.name]
-                if v == nil then
-                    diag:reporterror(e,"variable '"..e.name.."' not found")
-                    return e:aserror()
-                end
-                return asterraexpression(e,v, location)
-            elseif e:is "quote" then
-                return e.tree -- already checked tree, quotes get injected directly into some untyped trees by macros
-            elseif e:is "selectu" then
-                local v = checkexp(e.value,"luavalue")
-                local f = checklabel(e.field,true)
-                local field = f.value
-
-                if v:is "luaobject" then -- handle A.B where A is a luatable or type
-                    --check for and handle Type.staticmethod
-                    if terra.types.istype(v.value) and v.value:isstruct() then
-                        local fnlike, errmsg = v.value:getmethod(field)
-                        if not fnlike then
-                            diag:reporterror(e,errmsg)
-                            return e:aserror()
-                        end
-                        return asterraexpression(e,fnlike, location)
-                    elseif type(v.value) ~= "table" then
-                        diag:reporterror(e,"expected a table but found ", terra.type(v.value))
-                        return e:aserror()
-                    else
-                        local selected = invokeuserfunction(e,"extracting field "..tostring(field),false,function() return v.value[field] end)
-                        if selected == nil then
-                            diag:reporterror(e,"no field ", field," in lua object")
-                            return e:aserror()
-                        end
-                        return asterraexpression(e,selected,location)
-                    end
-                end
-
-                if v.type:ispointertostruct() then --allow 1 implicit dereference
-                    v = insertdereference(v)
-                end
+    --expression checkers, indexed by the kind of the untyped tree
+    local expression_table = {}
+    function expression_table.literal(e,location)
+        return e
+    end
+    function expression_table.var(e,location)
+        local v = env:combinedenv()[e.name]
+        if v == nil then
+            diag:reporterror(e,"variable '"..e.name.."' not found")
+            return e:aserror()
+        end
+        return asterraexpression(e,v, location)
+    end
+    function expression_table.quote(e,location)
+        return e.tree -- already checked tree, quotes get injected directly into some untyped trees by macros
+    end
+    function expression_table.selectu(e,location)
+        local v = checkexp(e.value,"luavalue")
+        local f = checklabel(e.field,true)
+        local field = f.value
 
-                if v.type:isstruct() then
-                    local ret, success = insertselect(v,field)
-                    if not success then
-                        --struct has no member field, call metamethod __entrymissing
-                        local typ = v.type
-
-                        local function checkmacro(metamethod,arguments,location)
-                            local named = terra.internalmacro(function(ctx,tree,...)
-                                return typ.metamethods[metamethod]:run(ctx,tree,field,...)
-                            end)
-                            local getter = asterraexpression(e, named, "luaobject")
-                            return checkcall(v, terra.newlist{ getter }, arguments, "first", false, location)
-                        end
-                        if location == "lexpression" and typ.metamethods.__setentry then
-                            local function setter(rhs)
-                                return checkmacro("__setentry", terra.newlist { v , rhs }, "statement")
-                            end
-                            return newobject(v,T.setteru,setter)
-                        elseif terra.ismacro(typ.metamethods.__entrymissing) then
-                            return checkmacro("__entrymissing",terra.newlist { v },location)
-                        else
-                            diag:reporterror(v,"no field ",field," in terra object of type ",v.type)
-                            return e:aserror()
-                        end
-                    else
-                        return ret
-                    end
-                else
-                    diag:reporterror(v,"expected a structural type")
+        if v:is "luaobject" then -- handle A.B where A is a luatable or type
+            --check for and handle Type.staticmethod
+            if terra.types.istype(v.value) and v.value:isstruct() then
+                local fnlike, errmsg = v.value:getmethod(field)
+                if not fnlike then
+                    diag:reporterror(e,errmsg)
                     return e:aserror()
                 end
-            elseif e:is "luaexpression" then
-                return checkluaexpression(e,location)
-            elseif e:is "operator" then
-                return checkoperator(e)
-            elseif e:is "cast" then -- inserted by global to force a cast in the initializer
-                return insertcast(checkexp(e.expression), e.to)
-            elseif e:is "index" then
-                local v = checkexp(e.value)
-                local idx = checkexp(e.index)
-                local typ,lvalue = terra.types.error, v.type:ispointer() or (v.type:isarray() and v.lvalue)
-                if v.type:ispointer() or v.type:isarray() or v.type:isvector() then
-                    typ = v.type.type
-                    if not idx.type:isintegral() and idx.type ~= terra.types.error then
-                        diag:reporterror(e,"expected integral index but found ",idx.type)
-                    end
-                    if v.type:isarray() then
-                        v = insertcast(v,terra.types.pointer(typ))
-                    end
-                else
-                    if v.type ~= terra.types.error then
-                        diag:reporterror(e,"expected an array or pointer but found ",v.type)
-                    end
+                return asterraexpression(e,fnlike, location)
+            elseif type(v.value) ~= "table" then
+                diag:reporterror(e,"expected a table but found ", terra.type(v.value))
+                return e:aserror()
+            else
+                local selected = invokeuserfunction(e,"extracting field "..tostring(field),false,function() return v.value[field] end)
+                if selected == nil then
+                    diag:reporterror(e,"no field ", field," in lua object")
+                    return e:aserror()
                 end
-                return e:copy { value = v, index = idx }:withtype(typ):setlvalue(lvalue)
-            elseif e:is "sizeof" then
-                e.oftype:tcomplete(e)
-                return e:copy{}:withtype(terra.types.uint64)
-            elseif e:is "vectorconstructor" or e:is "arrayconstructor" then
-                local entries = checkexpressions(e.expressions)
-                local N = #entries
-
-                local typ
-                if e.oftype ~= nil then
-                    typ = e.oftype:tcomplete(e)
-                else
-                    if N == 0 then
-                        diag:reporterror(e,"cannot determine type of empty aggregate")
-                        return e:aserror()
-                    end
+                return asterraexpression(e,selected,location)
+            end
+        end
 
-                    --figure out what type this vector has
-                    typ = entries[1].type
-                    for i,e2 in ipairs(entries) do
-                        typ = typemeet(e,typ,e2.type)
-                    end
-                end
+        if v.type:ispointertostruct() then --allow 1 implicit dereference
+            v = insertdereference(v)
+        end
 
-                local aggtype
-                if e:is "vectorconstructor" then
-                    if not typ:isprimitive() and typ ~= terra.types.error then
-                        diag:reporterror(e,"vectors must be composed of primitive types (for now...) but found type ",terra.type(typ))
-                        return e:aserror()
-                    end
-                    aggtype = terra.types.vector(typ,N)
-                else
-                    aggtype = terra.types.array(typ,N)
-                end
+        if v.type:isstruct() then
+            local ret, success = insertselect(v,field)
+            if not success then
+                --struct has no member field, call metamethod __entrymissing
+                local typ = v.type
 
-                --insert the casts to the right type in the parameter list
-                local typs = entries:map(function(x) return typ end)
-                entries = insertcasts(e,typs,entries)
-                return e:copy { expressions = entries }:withtype(aggtype)
-            elseif e:is "attrload" then
-                local addr = checkexp(e.address)
-                if not addr.type:ispointer() then
-                    diag:reporterror(e,"address must be a pointer but found ",addr.type)
-                    return e:aserror()
-                end
-                return e:copy { address = addr }:withtype(addr.type.type)
-            elseif e:is "attrstore" then
-                local addr = checkexp(e.address)
-                if not addr.type:ispointer() then
-                    diag:reporterror(e,"address must be a pointer but found ",addr.type)
-                    return e:aserror()
-                end
-                local value = insertcast(checkexp(e.value),addr.type.type)
-                return e:copy { address = addr, value = value }:withtype(terra.types.unit)
-            elseif e:is "apply" then
-                return checkapply(e,location)
-            elseif e:is "method" then
-                return checkmethod(e,location)
-            elseif e:is "letin" then
-                local ns = checkstmts(e.statements)
-                local ne = checkexpressions(e.expressions)
-                return createlet(e,ns,ne,e.hasstatements)
-           elseif e:is "constructoru" then
-                local paramlist = terra.newlist()
-                local named = 0
-                for i,f in ipairs(e.records) do
-                    local value = checkexp(f.value)
-                    named = named + (f.key and 1 or 0)
-                    if not f.key and value:is "letin" and not value.hasstatements then
-                        paramlist:insertall(value.expressions)
-                    else
-                        paramlist:insert(value)
-                    end
+                local function checkmacro(metamethod,arguments,location)
+                    local named = terra.internalmacro(function(ctx,tree,...)
+                        return typ.metamethods[metamethod]:run(ctx,tree,field,...)
+                    end)
+                    local getter = asterraexpression(e, named, "luaobject")
+                    return checkcall(v, terra.newlist{ getter }, arguments, "first", false, location)
                 end
-                local typ = terra.types.error
-                if named == 0 then
-                    typ = terra.types.tuple(unpack(paramlist:map("type")))
-                elseif named == #e.records then
-                    typ = terra.types.newstructwithanchor("anon",e)
-                    typ:setconvertible("named")
-                    for i,e in ipairs(e.records) do
-                        typ.entries:insert({field = checklabel(e.key,true).value, type = paramlist[i].type})
+                if location == "lexpression" and typ.metamethods.__setentry then
+                    local function setter(rhs)
+                        return checkmacro("__setentry", terra.newlist { v , rhs }, "statement")
                     end
+                    return newobject(v,T.setteru,setter)
+                elseif terra.ismacro(typ.metamethods.__entrymissing) then
+                    return checkmacro("__entrymissing",terra.newlist { v },location)
                 else
-                    diag:reporterror(e, "some entries in constructor are named while others are not")
+                    diag:reporterror(v,"no field ",field," in terra object of type ",v.type)
+                    return e:aserror()
                 end
-                return newobject(e,T.constructor,paramlist):withtype(typ:tcomplete(e))
-            elseif e:is "inlineasm" then
-                return e:copy { arguments = checkexpressions(e.arguments) }
-            elseif e:is "debuginfo" then
-                return e:copy{}:withtype(terra.types.unit)
             else
-                diag:reporterror(e,"statement found where an expression is expected ", e.kind)
+                return ret
+            end
+        else
+            diag:reporterror(v,"expected a structural type")
+            return e:aserror()
+        end
+    end
+    function expression_table.luaexpression(e,location)
+        return checkluaexpression(e,location)
+    end
+    function expression_table.operator(e,location)
+        return checkoperator(e)
+    end
+    function expression_table.cast(e,location)  -- inserted by global to force a cast in the initializer
+        return insertcast(checkexp(e.expression), e.to)
+    end
+    function expression_table.index(e,location)
+        local v = checkexp(e.value)
+        local idx = checkexp(e.index)
+        local typ,lvalue = terra.types.error, v.type:ispointer() or (v.type:isarray() and v.lvalue)
+        if v.type:ispointer() or v.type:isarray() or v.type:isvector() then
+            typ = v.type.type
+            if not idx.type:isintegral() and idx.type ~= terra.types.error then
+                diag:reporterror(e,"expected integral index but found ",idx.type)
+            end
+            if v.type:isarray() then
+                v = insertcast(v,terra.types.pointer(typ))
+            end
+        else
+            if v.type ~= terra.types.error then
+                diag:reporterror(e,"expected an array or pointer but found ",v.type)
+            end
+        end
+        return e:copy { value = v, index = idx }:withtype(typ):setlvalue(lvalue)
+    end
+    function expression_table.sizeof(e,location)
+        e.oftype:tcomplete(e)
+        return e:copy{}:withtype(terra.types.uint64)
+    end
+    local function checkaggregateconstructor(e,location)
+        local entries = checkexpressions(e.expressions)
+        local N = #entries
+
+        local typ
+        if e.oftype ~= nil then
+            typ = e.oftype:tcomplete(e)
+        else
+            if N == 0 then
+                diag:reporterror(e,"cannot determine type of empty aggregate")
+                return e:aserror()
+            end
+
+            --figure out what type this vector has
+            typ = entries[1].type
+            for i,e2 in ipairs(entries) do
+                typ = typemeet(e,typ,e2.type)
+            end
+        end
+
+        local aggtype
+        if e:is "vectorconstructor" then
+            if not typ:isprimitive() and typ ~= terra.types.error then
+                diag:reporterror(e,"vectors must be composed of primitive types (for now...) but found type ",terra.type(typ))
                 return e:aserror()
             end
+            aggtype = terra.types.vector(typ,N)
+        else
+            aggtype = terra.types.array(typ,N)
         end
 
-        local result = docheck(e_)
+        --insert the casts to the right type in the parameter list
+        local typs = entries:map(function(x) return typ end)
+        entries = insertcasts(e,typs,entries)
+        return e:copy { expressions = entries }:withtype(aggtype)
+    end
+    function expression_table.attrload(e,location)
+        local addr = checkexp(e.address)
+        if not addr.type:ispointer() then
+            diag:reporterror(e,"address must be a pointer but found ",addr.type)
+            return e:aserror()
+        end
+        return e:copy { address = addr }:withtype(addr.type.type)
+    end
+    function expression_table.attrstore(e,location)
+        local addr = checkexp(e.address)
+        if not addr.type:ispointer() then
+            diag:reporterror(e,"address must be a pointer but found ",addr.type)
+            return e:aserror()
+        end
+        local value = insertcast(checkexp(e.value),addr.type.type)
+        return e:copy { address = addr, value = value }:withtype(terra.types.unit)
+    end
+    function expression_table.apply(e,location)
+        return checkapply(e,location)
+    end
+    function expression_table.method(e,location)
+        return checkmethod(e,location)
+    end
+    function expression_table.letin(e,location)
+        local ns = checkstmts(e.statements)
+        local ne = checkexpressions(e.expressions)
+        return createlet(e,ns,ne,e.hasstatements)
+    end
+    function expression_table.constructoru(e,location)
+        local paramlist = terra.newlist()
+        local named = 0
+        for i,f in ipairs(e.records) do
+            local value = checkexp(f.value)
+            named = named + (f.key and 1 or 0)
+            if not f.key and value:is "letin" and not value.hasstatements then
+                paramlist:insertall(value.expressions)
+            else
+                paramlist:insert(value)
+            end
+        end
+        local typ = terra.types.error
+        if named == 0 then
+            typ = terra.types.tuple(unpack(paramlist:map("type")))
+        elseif named == #e.records then
+            typ = terra.types.newstructwithanchor("anon",e)
+            typ:setconvertible("named")
+            for i,e in ipairs(e.records) do
+                typ.entries:insert({field = checklabel(e.key,true).value, type = paramlist[i].type})
+            end
+        else
+            diag:reporterror(e, "some entries in constructor are named while others are not")
+        end
+        return newobject(e,T.constructor,paramlist):withtype(typ:tcomplete(e))
+    end
+    function expression_table.inlineasm(e,location)
+        return e:copy { arguments = checkexpressions(e.arguments) }
+    end
+    function expression_table.debuginfo(e,location)
+        return e:copy{}:withtype(terra.types.unit)
+    end
+    expression_table.vectorconstructor = checkaggregateconstructor
+    expression_table.arrayconstructor = checkaggregateconstructor
+
+    function checkexp(e_, location)
+        location = location or "expression"
+        assert(type(location) == "string")
+        if not terra.istree(e_) then
+            print("not a tree?")
+            print(debug.traceback())
+            terra.printraw(e_)
+        end
+        local docheck = expression_table[e_.kind]
+        local result
+        if docheck then
+            result = docheck(e_,location)
+        else
+            diag:reporterror(e_,"statement found where an expression is expected ", e_.kind)
+            result = e_:aserror()
+        end
         --freeze all types returned by the expression (or list of expressions)
         if not result:is "luaobject" and not result:is "setteru" then
             assert(terra.types.istype(result.type))
@@ -3137,97 +3393,119 @@ function typecheck(topexp,luaenv,simultaneousdefinitions)
         return s:copy {statements = stats}
     end
 
-    function checkstmts(stmts)
-        local function checksingle(s)
-            if s:is "block" then
-                return checkblock(s)
-            elseif s:is "returnstat" then
-                return s:copy { expression = checkexp(s.expression)}
-            elseif s:is "label" or s:is "gotostat" then
-                local ss = checklabel(s.label)
-                return copyobject(s, { label = ss })
-            elseif s:is "breakstat" then
-                return s
-            elseif s:is "whilestat" then
-                return checkcondbranch(s)
-            elseif s:is "fornumu" then
-                local initial, limit, step = checkexp(s.initial), checkexp(s.limit), s.step and checkexp(s.step)
-                local t = typemeet(initial,initial.type,limit.type)
-                t = step and typemeet(limit,t,step.type) or t
-                local variables = checkformalparameterlist(List {s.variable },false)
-                if #variables ~= 1 then
-                    diag:reporterror(s.variable, "expected a single iteration variable but found ",#variables)
-                    return s
-                end
-                local variable = variables[1]
-                variable:settype(variable.type or t)
-                if not variable.type:isintegral() then diag:reporterror(variable,"expected an integral type for loop initialization but found ",variable.type) end
-                initial,step,limit = insertcast(initial,variable.type), step and insertcast(step,variable.type), insertcast(limit,variable.type)
-                local body = checkblock(s.body)
-                return newobject(s,T.fornum,variable,initial,limit,step,body)
-            elseif s:is "forlist" then
-                local iterator = checkexp(s.iterator)
-
-                local typ = iterator.type
-                if typ:ispointertostruct() then
-                    typ,iterator = typ.type, insertdereference(iterator)
-                end
-                if not typ:isstruct() or type(typ.metamethods.__for) ~= "function" then
-                    diag:reporterror(iterator,"expected a struct with a __for metamethod but found ",typ)
-                    return s
-                end
-                local generator = typ.metamethods.__for
+    --statement checkers, indexed by the kind of the untyped tree.
+    --anything else is an expression used as a statement
+    local statement_table = {}
+    function statement_table.block(s)
+        return checkblock(s)
+    end
+    function statement_table.returnstat(s)
+        return s:copy { expression = checkexp(s.expression)}
+    end
+    local function checklabelstmt(s)
+        local ss = checklabel(s.label)
+        return copyobject(s, { label = ss })
+    end
+    function statement_table.breakstat(s)
+        return s
+    end
+    function statement_table.whilestat(s)
+        return checkcondbranch(s)
+    end
+    function statement_table.fornumu(s)
+        local initial, limit, step = checkexp(s.initial), checkexp(s.limit), s.step and checkexp(s.step)
+        local t = typemeet(initial,initial.type,limit.type)
+        t = step and typemeet(limit,t,step.type) or t
+        local variables = checkformalparameterlist(List {s.variable },false)
+        if #variables ~= 1 then
+            diag:reporterror(s.variable, "expected a single iteration variable but found ",#variables)
+            return s
+        end
+        local variable = variables[1]
+        variable:settype(variable.type or t)
+        if not variable.type:isintegral() then diag:reporterror(variable,"expected an integral type for loop initialization but found ",variable.type) end
+        initial,step,limit = insertcast(initial,variable.type), step and insertcast(step,variable.type), insertcast(limit,variable.type)
+        local body = checkblock(s.body)
+        return newobject(s,T.fornum,variable,initial,limit,step,body)
+    end
+    function statement_table.forlist(s)
+        local iterator = checkexp(s.iterator)
 
-                local function bodycallback(...)
-                    local exps = List()
-                    for i = 1,select("#",...) do
-                        local v = select(i,...)
-                        exps:insert(asterraexpression(s,v))
-                    end
-                    env:enterblock()
-                    local variables = checkformalparameterlist(s.variables,false)
-                    local assign = createassignment(s,variables,exps)
-                    local body = checkblock(s.body)
-                    env:leaveblock()
-                    local stats = createstatementlist(s, List { assign, body })
-                    return terra.newquote(stats)
-                end
+        local typ = iterator.type
+        if typ:ispointertostruct() then
+            typ,iterator = typ.type, insertdereference(iterator)
+        end
+        if not typ:isstruct() or type(typ.metamethods.__for) ~= "function" then
+            diag:reporterror(iterator,"expected a struct with a __for metamethod but found ",typ)
+            return s
+        end
+        local generator = typ.metamethods.__for
 
-                local value = invokeuserfunction(s, "invoking __for", false ,generator,terra.newquote(iterator), bodycallback)
-                return asterraexpression(s,value,"statement")
-            elseif s:is "ifstat" then
-                local br = s.branches:map(checkcondbranch)
-                local els = (s.orelse and checkblock(s.orelse))
-                return s:copy{ branches = br, orelse = els }
-            elseif s:is "repeatstat" then
-                local stmts = checkstmts(s.statements)
-                local e = checkcond(s.condition)
-                return s:copy { statements = stmts, condition = e }
-            elseif s:is "defvar" then
-                local rhs = s.hasinit and checkexpressions(s.initializers)
-                local lhs = checkformalparameterlist(s.variables, not s.hasinit)
-                local res = s.hasinit and createassignment(s,lhs,rhs)
-                            or createstatementlist(s,lhs)
-                return res
-            elseif s:is "assignment" then
-                local rhs = checkexpressions(s.rhs)
-                local lhs = checkexpressions(s.lhs,"lexpression")
-                return createassignment(s,lhs,rhs)
-            elseif s:is "apply" then
-                return checkapply(s,"statement")
-            elseif s:is "method" then
-                return checkmethod(s,"statement")
-            elseif s:is "defer" then
-                local call = checkexp(s.expression)
-                if not call:is "apply" then
-                    diag:reporterror(s.expression,"deferred statement must resolve to a function call")
-                end
-                return s:copy { expression = call }
-            else
-                return checkexp(s,"statement")
+        local function bodycallback(...)
+            local exps = List()
+            for i = 1,select("#",...) do
+                local v = select(i,...)
+                exps:insert(asterraexpression(s,v))
             end
-            error("NYI - "..s.kind,2)
+            env:enterblock()
+            local variables = checkformalparameterlist(s.variables,false)
+            local assign = createassignment(s,variables,exps)
+            local body = checkblock(s.body)
+            env:leaveblock()
+            local stats = createstatementlist(s, List { assign, body })
+            return terra.newquote(stats)
         end
+
+        local value = invokeuserfunction(s, "invoking __for", false ,generator,terra.newquote(iterator), bodycallback)
+        return asterraexpression(s,value,"statement")
+    end
+    function statement_table.ifstat(s)
+        local br = s.branches:map(checkcondbranch)
+        local els = (s.orelse and checkblock(s.orelse))
+        return s:copy{ branches = br, orelse = els }
+    end
+    function statement_table.repeatstat(s)
+        local stmts = checkstmts(s.statements)
+        local e = checkcond(s.condition)
+        return s:copy { statements = stmts, condition = e }
+    end
+    function statement_table.defvar(s)
+        local rhs = s.hasinit and checkexpressions(s.initializers)
+        local lhs = checkformalparameterlist(s.variables, not s.hasinit)
+        local res = s.hasinit and createassignment(s,lhs,rhs)
+                    or createstatementlist(s,lhs)
+        return res
+    end
+    function statement_table.assignment(s)
+        local rhs = checkexpressions(s.rhs)
+        local lhs = checkexpressions(s.lhs,"lexpression")
+        return createassignment(s,lhs,rhs)
+    end
+    function statement_table.apply(s)
+        return checkapply(s,"statement")
+    end
+    function statement_table.method(s)
+        return checkmethod(s,"statement")
+    end
+    function statement_table.defer(s)
+        local call = checkexp(s.expression)
+        if not call:is "apply" then
+            diag:reporterror(s.expression,"deferred statement must resolve to a function call")
+        end
+        return s:copy { expression = call }
+    end
+    statement_table.label = checklabelstmt
+    statement_table.gotostat = checklabelstmt
+
+    local function checksingle(s)
+        local check = statement_table[s.kind]
+        if check then
+            return check(s)
+        end
+        return checkexp(s,"statement")
+    end
+
+    function checkstmts(stmts)
         local newstats = List()
         local function addstat(s)
             if s.kind == "letin" then --let blocks are collapsed into surrounding scope
@@ -3349,13 +3627,18 @@ end
 
 terra.includepath = os.getenv("INCLUDE_PATH") or "."
 
-local internalizedfiles = {}
+local internalizedfiles,pendinginternalizedfiles = {},List()
 local function fileparts(path)
     local fileseparators = ffi.os == "Windows" and "\\/" or "/"
     local pattern = "[%s]([^%s]*)"
     return path:gmatch(pattern:format(fileseparators,fileseparators))
 end
+-- the directory tree is only needed by includec and require of internal files, so it is
+-- built on the first lookup
 function terra.registerinternalizedfiles(names,contents,sizes)
+    pendinginternalizedfiles:insert { names, contents, sizes }
+end
+local function addinternalizedfiles(names,contents,sizes)
     names,contents,sizes = ffi.cast("const char **",names),ffi.cast("uint8_t **",contents),ffi.cast("int*",sizes)
     for i = 0,math.huge do
         if names[i] == nil then break end
@@ -3374,6 +3657,12 @@ function terra.registerinternalizedfiles(names,contents,sizes)
 end
 
 local function getinternalizedfile(path)
+    if #pendinginternalizedfiles > 0 then
+        for _,p in ipairs(pendinginternalizedfiles) do
+            addinternalizedfiles(unpack(p))
+        end
+        pendinginternalizedfiles = List()
+    end
     local cur = internalizedfiles
     for segment in fileparts(path) do
         if cur.children and cur.children[segment] then
@@ -3392,9 +3681,8 @@ end
 
 
 
-function terra.includecstring(code,cargs,target)
+local function includecargs(cargs,target)
     local args = terra.newlist {"-O3","-Wno-deprecated","-resource-dir",clangresourcedirectory}
-    target = target or terra.nativetarget
 
     if (target == terra.nativetarget and ffi.os == "Linux") or (target.Triple and target.Triple:match("linux")) then
         args:insert("-internal-isystem")
@@ -3412,10 +3700,22 @@ function terra.includecstring(code,cargs,target)
         args:insert("-I")
         args:insert(p)
     end
-    assert(terra.istarget(target),"expected a target or nil to specify the native target")
-    local result = terra.registercfile(target,code,args,headerprovider)
-    local general,tagged,errors,macros = result.general,result.tagged,result.errors,result.macros
-    local mt = { __index = includetableindex, errors = result.errors }
+    return args
+end
+
+local function includecresult(result)
+    local general,tagged,errors = result.general,result.tagged,result.errors
+    local lookupmacro = result.lookupmacro or function() return nil end
+    -- numeric macros are evaluated the first time they are asked for, since headers
+    -- define far more of them than any program uses
+    local macros = setmetatable({},{ __index = function(self,name)
+        if type(name) ~= "string" then return nil end
+        local v = lookupmacro(name)
+        if v ~= nil then
+            rawset(self,name,v)
+        end
+        return v
+    end })
     local function addtogeneral(tbl)
         for k,v in pairs(tbl) do
             if not general[k] then
@@ -3424,14 +3724,50 @@ function terra.includecstring(code,cargs,target)
         end
     end
     addtogeneral(tagged)
-    addtogeneral(macros)
+    local mt = { __index = function(self,name)
+        local v = macros[name]
+        if v ~= nil then
+            rawset(self,name,v)
+            return v
+        end
+        return includetableindex(self,name)
+    end, errors = errors }
     setmetatable(general,mt)
-    setmetatable(tagged,mt)
+    setmetatable(tagged,{ __index = includetableindex, errors = errors })
     return general,tagged,macros
 end
+
+function terra.includecstring(code,cargs,target)
+    target = target or terra.nativetarget
+    assert(terra.istarget(target),"expected a target or nil to specify the native target")
+    local args = includecargs(cargs,target)
+    return includecresult(terra.registercfile(target,code,args,headerprovider))
+end
 function terra.includec(fname,cargs,target)
     return terra.includecstring("#include \""..fname.."\"\n",cargs,target)
 end
+-- include several independent headers at once, parsing them in parallel when supported
+-- returns a list with the namespace table includec would return for each header
+function terra.includecmulti(fnames,cargs,target)
+    target = target or terra.nativetarget
+    assert(terra.istarget(target),"expected a target or nil to specify the native target")
+    local namespaces = List()
+    if not terra.registercfiles then
+        for i,fname in ipairs(fnames) do
+            namespaces:insert((terra.includec(fname,cargs,target)))
+        end
+        return namespaces
+    end
+    local codes = List()
+    for i,fname in ipairs(fnames) do
+        codes:insert("#include \""..fname.."\"\n")
+    end
+    local results = terra.registercfiles(target,codes,includecargs(cargs,target),headerprovider)
+    for i,result in ipairs(results) do
+        namespaces:insert((includecresult(result)))
+    end
+    return namespaces
+end
 
 
 -- GLOBAL MACROS
@@ -3545,6 +3881,53 @@ terra.attrstore = terra.internalmacro( function(diag,tree,addr,value,attr)
     return typecheck(newobject(tree,T.attrstore,addr,value,createattributetable(attr)))
 end)
 
+local loophintkinds = { unroll = { number = true, boolean = true }, vectorize = { boolean = true },
+                        vectorizewidth = { number = true }, interleave = { number = true } }
+-- returns a copy of quote q whose outermost loops carry the optimizer hints in 'hints'
+function terra.loophint(hints,q)
+    if type(hints) ~= "table" then
+        error("loop hints must be a table, not a " .. type(hints))
+    end
+    for k,v in pairs(hints) do
+        local valid = loophintkinds[k]
+        if not valid then
+            error("unknown loop hint "..tostring(k))
+        elseif not valid[type(v)] then
+            error("loop hint "..k.." cannot be a "..type(v))
+        elseif type(v) == "number" and (v < 1 or v ~= math.floor(v)) then
+            error("loop hint "..k.." must be a positive integer but found "..v)
+        end
+    end
+    if not terra.isquote(q) then
+        error("loophint expects a quote containing a loop")
+    end
+    local found = false
+    local function clone(s)
+        local r = {}
+        for k,v in pairs(s) do r[k] = v end
+        return setmetatable(r,getmetatable(s))
+    end
+    local function visit(s)
+        if s:is "letin" or s:is "block" then
+            local r = clone(s)
+            r.statements = List()
+            for i,ss in ipairs(s.statements) do r.statements[i] = visit(ss) end
+            return r
+        elseif s:is "fornum" or s:is "whilestat" or s:is "repeatstat" then
+            found = true
+            local r = clone(s)
+            r.loophints = hints
+            return r
+        end
+        return s
+    end
+    local tree = visit(q.tree)
+    if not found then
+        error("loophint expects a quote containing a loop")
+    end
+    return terra.newquote(tree)
+end
+
 
 -- END GLOBAL MACROS
 
@@ -4002,9 +4385,10 @@ function compilationunit:saveobj(filename,filekind,arguments,optimize)
         filekind,arguments,optimize = nil,filekind,arguments
     end
 
-    if optimize == nil then
-        optimize = true
+    if optimize == nil or optimize == true then
+        optimize = self.optlevel
     end
+    if optimize then checkoptlevel(optimize) end
 
     if filekind == nil and filename ~= nil then
         --infer filekind from string
@@ -4054,6 +4438,99 @@ local terradefaultpath =  ffi.os == "Windows" and ";.\\?.t;"..terra.terrahome.."
 
 package.terrapath = (os.getenv("TERRA_PATH") or ";;"):gsub(";;",terradefaultpath)
 
+-- module cache: require saves the parsed form of each .t file it loads (the bytecode of
+-- the Lua chunk plus the Terra trees the chunk refers to) in a .tc file, and uses it on
+-- later runs as long as the source is unchanged. The cache is off unless
+-- terra.usemodulecache is set, or TERRA_CACHE_DIR names a directory for the .tc files;
+-- if terra.cachedirectory is nil they are written next to the source.
+terra.cachedirectory = os.getenv("TERRA_CACHE_DIR")
+terra.usemodulecache = terra.cachedirectory ~= nil
+local modulecachemagic = "TERRATC1\n"
+local treeclasses
+local function gettreeclasses()
+    if not treeclasses then
+        -- every class T defines, in a stable order, so the indices mean the same thing
+        -- in every run
+        local names = List()
+        for name,v in pairs(T.definitions) do
+            if type(v) == "table" and rawget(v,"__index") == v then
+                names:insert(name)
+            end
+        end
+        table.sort(names)
+        treeclasses = { list = List { List }, index = { [List] = 1 } }
+        for _,name in ipairs(names) do
+            local cls = T.definitions[name]
+            treeclasses.list:insert(cls)
+            treeclasses.index[cls] = #treeclasses.list
+        end
+        treeclasses.version = terra.version..":"..#treeclasses.list
+    end
+    return treeclasses
+end
+local function modulecachefile(file)
+    if terra.cachedirectory then
+        return terra.cachedirectory.."/"..file:gsub("[/\\:]","_").."c"
+    end
+    return file.."c"
+end
+local function readfile(file)
+    local handle = io.open(file,"rb")
+    if not handle then return nil end
+    local str = handle:read("*a")
+    handle:close()
+    return str
+end
+-- a module's cache data: the bytecode of its chunk and its serialized trees
+local function encodemodule(source,fn,key)
+    local classes = gettreeclasses()
+    local trees = terra.serializetrees(terra._trees[key] or {},classes.index)
+    if not trees then return nil end -- the trees hold values that cannot be saved
+    local code = string.dump(fn)
+    return table.concat { modulecachemagic,classes.version,"\n",terra.hashstring(source),"\n",key,"\n",#code,"\n",code,trees }
+end
+-- returns the chunk saved in data, or nil if data is malformed or out of date
+local function decodemodule(data,file,source)
+    if not data or data:sub(1,#modulecachemagic) ~= modulecachemagic then return nil end
+    local version,hash,key,codesize,pos = data:match("^([^\n]*)\n([^\n]*)\n([^\n]*)\n(%d+)\n()",#modulecachemagic + 1)
+    local classes = gettreeclasses()
+    if version ~= classes.version or hash ~= terra.hashstring(source) or terra._trees[key] then
+        return nil
+    end
+    local fn = loadstring(data:sub(pos,pos + codesize - 1))
+    if not fn then return nil end
+    local trees = terra.deserializetrees(data:sub(pos + codesize),classes.list,"@"..file)
+    if trees == nil then return nil end
+    if next(trees) then
+        terra._trees[key] = trees
+    end
+    return fn
+end
+local function savecachedmodule(file,data)
+    if not data then return end
+    local cachefile = modulecachefile(file)
+    local handle = io.open(cachefile..".tmp","wb")
+    if not handle then return end
+    handle:write(data)
+    handle:close()
+    os.remove(cachefile)
+    if not os.rename(cachefile..".tmp",cachefile) then
+        os.remove(cachefile..".tmp")
+    end
+end
+local function loadterramodule(file)
+    local source = terra.usemodulecache and readfile(file)
+    -- language extensions run while parsing, so modules that import them are not cached
+    if not source or source:match("%f[%w_]import%f[^%w_]") then return terra.loadfile(file) end
+    local fn = decodemodule(readfile(modulecachefile(file)),file,source)
+    if fn then return fn end
+    local fn,err = terra.loadfile(file)
+    if fn then
+        savecachedmodule(file,encodemodule(source,fn,terra._lasttreeskey))
+    end
+    return fn,err
+end
+
 local function terraloader(name)
     local fname = name:gsub("%.","/")
     local file = nil
@@ -4069,7 +4546,9 @@ local function terraloader(name)
         loaderr = loaderr .. "\n\tno file '"..fpath.."'"
     end
     local function check(fn,err) return fn or error(string.format("error loading terra module %s from file %s:\n\t%s",name,file,err)) end
-    if file then return check(terra.loadfile(file)) end
+    if file then
+        return check(loadterramodule(file))
+    end
     -- if we didn't find the file on the real file system, see if it is included in the binary itself
     file = ("/?.t"):gsub("%?",fname)
     local internal = getinternalizedfile(file)
@@ -4147,14 +4626,8 @@ function terra.constant(typ,init)
     if type(init) ~= "cdata" or terra.typeof(init) ~= typ then
         init = terra.cast(typ,init)
     end
-    if not typ:isaggregate() then
-        return terra.newquote(newobject(anchor,T.constant,init,typ))
-    end -- otherwise this is an aggregate pack it into a string literal
-    local str,ptyp = ffi.string(init,terra.sizeof(typ)),terra.types.pointer(typ)
-    local tree = newobject(anchor,T.literal,str,terra.types.rawstring) -- "literal"
-    tree = newobject(anchor,T.cast,ptyp,tree):withtype(ptyp) -- [&typ](literal)
-    tree = newobject(anchor,T.operator,"@", List { tree }):withtype(typ):setlvalue(true) -- @[&typ](literal)
-    return terra.newquote(tree)
+    -- aggregates are lvalues so they can be indexed and have their address taken
+    return terra.newquote(newobject(anchor,T.constant,init,typ):setlvalue(typ:isaggregate()))
 end
 function terra.isconstant(obj)
     if T.globalvariable:isclassof(obj) then return obj:isconstant()
@@ -4195,7 +4668,10 @@ function terra.linkllvm(filename,target,fromstring)
     target = target or terra.nativetarget
     assert(terra.istarget(target),"expected a target or nil to specify native target")
     terra.linkllvmimpl(target.llvm_target,filename, fromstring)
-    return { extern = function(self,name,typ) return terra.externfunction(name,typ) end }
+    return { extern = function(self,name,typ) return terra.externfunction(name,typ) end,
+             loadedfunctions = function(self)
+                 return fromstring and {} or terra.linkedfunctions(target.llvm_target,filename)
+             end }
 end
 function terra.linkllvmstring(str,target) return terra.linkllvm(str,target,true) end
 
@@ -4465,5 +4941,133 @@ function terra.initdebugfns(traceback,backtrace,lookupsymbol,lookupline,disas)
     terra.disas = terra.cast(FP({po,terra.types.uint64,terra.types.uint64},{}),disas)
 end
 
+-- PROFILER
+local profile = {}
+profile.__index = profile
+
+-- run fn under a sampling profiler that fires every options.interval microseconds of cpu time
+-- returns a profile object followed by the results of fn
+function terra.profile(fn,options)
+    if not terra.profilerstart then
+        error("profiling is not supported on this platform",2)
+    end
+    options = options or {}
+    terra.profilerstart(options.interval or 1000, options.maxsamples or 10000)
+    local results = terra.newlist { xpcall(fn,debug.traceback) }
+    local data = terra.profilerstop()
+    if not results[1] then error(results[2],0) end
+    data.interval = options.interval or 1000
+    return setmetatable(data,profile), unpack(results,2,table.maxn(results))
+end
+
+--name of a location, at function granularity or at line granularity when line info is available (-g)
+function profile:label(loc,bylines)
+    if loc.kind == "terra" and bylines and loc.file then
+        return ("%s (%s:%d)"):format(loc.name,loc.file,loc.line)
+    end
+    return loc.name
+end
+
+--returns a list of { name, self, total } sorted by self samples
+function profile:flat(bylines)
+    local entries,byname = terra.newlist(),{}
+    for _,sample in ipairs(self.samples) do
+        local seen = {}
+        for i,id in ipairs(sample) do
+            local name = self:label(self.locations[id],bylines)
+            local e = byname[name]
+            if not e then
+                e = { name = name, self = 0, total = 0 }
+                byname[name] = e
+                entries:insert(e)
+            end
+            if i == 1 then e.self = e.self + 1 end
+            if not seen[name] then --recursive functions are counted once per sample
+                seen[name] = true
+                e.total = e.total + 1
+            end
+        end
+    end
+    table.sort(entries,function(a,b) return a.self > b.self or a.self == b.self and a.total > b.total end)
+    return entries
+end
+
+--returns the root of a call tree, nodes are { name, count, children = { name -> node } }
+function profile:tree(bylines)
+    local root = { name = "<root>", count = 0, children = {} }
+    for _,sample in ipairs(self.samples) do
+        local node = root
+        node.count = node.count + 1
+        for i = #sample,1,-1 do
+            local name = self:label(self.locations[sample[i]],bylines)
+            local child = node.children[name]
+            if not child then
+                child = { name = name, count = 0, children = {} }
+                node.children[name] = child
+            end
+            child.count = child.count + 1
+            node = child
+        end
+    end
+    return root
+end
+
+--stacks in the collapsed format read by flamegraph.pl: "outer;...;inner count"
+function profile:collapsed(bylines)
+    local counts,order = {},terra.newlist()
+    for _,sample in ipairs(self.samples) do
+        local frames = terra.newlist()
+        for i = #sample,1,-1 do
+            frames:insert((self:label(self.locations[sample[i]],bylines):gsub(";",":")))
+        end
+        local stack = frames:concat(";")
+        if not counts[stack] then
+            counts[stack] = 0
+            order:insert(stack)
+        end
+        counts[stack] = counts[stack] + 1
+    end
+    return order:map(function(stack) return ("%s %d\n"):format(stack,counts[stack]) end):concat()
+end
+
+function profile:report(kind,bylines)
+    kind = kind or "flat"
+    local N = math.max(#self.samples,1)
+    local buffer = terra.newlist()
+    local function pct(n) return 100*n/N end
+    if kind == "flat" then
+        buffer:insert(("%8s %8s %8s  %s\n"):format("self%","total%","samples","location"))
+        for _,e in ipairs(self:flat(bylines)) do
+            buffer:insert(("%7.2f%% %7.2f%% %8d  %s\n"):format(pct(e.self),pct(e.total),e.self,e.name))
+        end
+    elseif kind == "tree" then
+        local function visit(node,depth)
+            local children = terra.newlist()
+            for _,c in pairs(node.children) do children:insert(c) end
+            table.sort(children,function(a,b) return a.count > b.count end)
+            for _,c in ipairs(children) do
+                buffer:insert(("%7.2f%% %8d  %s%s\n"):format(pct(c.count),c.count,("  "):rep(depth),c.name))
+                visit(c,depth + 1)
+            end
+        end
+        visit(self:tree(bylines),0)
+    elseif kind == "collapsed" then
+        buffer:insert(self:collapsed(bylines))
+    else
+        error("unknown profile report kind: "..tostring(kind),2)
+    end
+    if self.dropped > 0 then
+        buffer:insert(("(%d samples dropped, increase maxsamples)\n"):format(self.dropped))
+    end
+    return buffer:concat()
+end
+function profile:print(kind,bylines) io.write(self:report(kind,bylines)) end
+function profile:save(filename,bylines)
+    local file = assert(io.open(filename,"w"))
+    file:write(self:collapsed(bylines))
+    file:close()
+end
+-- END PROFILER
+
 _G["terralib"] = terra --terra code can't use "terra" because it is a keyword
 require'terralib_luapower'
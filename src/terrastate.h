@@ -11,6 +11,7 @@
 struct terra_CompilerState;
 struct terra_CUDAState;
 struct TerraTarget;
+struct TStringTable;
 
 typedef struct terra_State {
     struct lua_State *L;
@@ -20,8 +21,8 @@ typedef struct terra_State {
     std::vector<TerraTarget *> targets;
     // for parser
     int nCcalls;
-    char tstring_table;  //&tstring_table is used as the key into the lua registry that
-                         // maps strings in Lua to TString objects for the parser
+    unsigned numparses;  // used to name the tree table of each parsed chunk
+    struct TStringTable *strings;  // interned strings for the parser, see lstring.h
     size_t numlivefunctions;  // number of terra functions that are live in the system, +
                               // 1 if terra_free has not been called used to track when it
                               // is safe to delete the terra_State object.
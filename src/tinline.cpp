@@ -9,7 +9,8 @@
 
 using namespace llvm;
 
-ManualInliner::ManualInliner(TargetMachine *TM, Module *m) {
+ManualInliner::ManualInliner(TargetMachine *TM, Module *m, unsigned optlevel,
+                             unsigned sizelevel) {
 // Trick the Module-at-a-time inliner into running on a single SCC
 // First we run it on the (currently empty) module to initialize
 // the inlining pass with the Analysis passes it needs.
@@ -30,7 +31,11 @@ ManualInliner::ManualInliner(TargetMachine *TM, Module *m) {
 #if LLVM_VERSION >= 33 && LLVM_VERSION <= 36
     TM->addAnalysisPasses(PM);
 #endif
-    SI = (CallGraphSCCPass *)createFunctionInliningPass();
+#if LLVM_VERSION < 50
+    SI = (CallGraphSCCPass *)createFunctionInliningPass(optlevel, sizelevel);
+#else
+    SI = (CallGraphSCCPass *)createFunctionInliningPass(optlevel, sizelevel, false);
+#endif
     PM.add(SI);
     PM.run(*m);
 // save the call graph so we can keep it up to date
@@ -9,7 +9,9 @@ class ManualInliner {
     PassManager PM;
 
 public:
-    ManualInliner(llvm::TargetMachine *tm, llvm::Module *m);
+    // optlevel and sizelevel pick the inlining threshold, as in PassManagerBuilder
+    ManualInliner(llvm::TargetMachine *tm, llvm::Module *m, unsigned optlevel,
+                  unsigned sizelevel);
     void run(std::vector<llvm::Function *>::iterator fbegin,
              std::vector<llvm::Function *>::iterator fend);
     void eraseFunction(llvm::Function *f);
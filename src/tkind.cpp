@@ -9,6 +9,8 @@ extern "C" {
 static const char* kindtostr[] = {
 #define T_KIND_STRING(a, str) str,
         T_KIND_LIST(T_KIND_STRING) NULL};
+char terra_kindskey;
+
 const char* tkindtostr(T_Kind k) {
     assert(k < T_NUM_KINDS);
     return kindtostr[k];
@@ -22,6 +24,9 @@ void terra_kindsinit(terra_State* T) {
         lua_pushnumber(L, i);
         lua_setfield(L, -2, tkindtostr((T_Kind)i));
     }
+    lua_pushlightuserdata(L, &terra_kindskey);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, LUA_REGISTRYINDEX);
     lua_setfield(L, -2, "kinds");
     lua_pop(L, 1);  // terra object
 }
\ No newline at end of file
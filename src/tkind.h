@@ -81,4 +81,8 @@ enum T_Kind {
 const char* tkindtostr(T_Kind k);
 void terra_kindsinit(terra_State* T);
 
+// terra.kinds is also kept in the registry under the address of this variable
+// so Obj::kind can find it without going through the globals table
+extern char terra_kindskey;
+
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 /* See Copyright Notice in ../LICENSE.txt */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "tllvmutil.h"
 
@@ -26,6 +27,13 @@
 #if LLVM_VERSION < 50
 #include "llvm/Support/MemoryObject.h"
 #endif
+#if LLVM_VERSION >= 60
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/IPO/GlobalDCE.h"
+#include "llvm/Transforms/Vectorize/LoopVectorize.h"
+#include "llvm/Transforms/Vectorize/SLPVectorizer.h"
+#endif
 #ifndef _WIN32
 #include <sys/wait.h>
 #endif
@@ -72,10 +80,23 @@ public:
             PM->add(P);
     }
 };
-void llvmutil_addoptimizationpasses(PassManagerBase *fpm) {
+llvmutil_OptLevel llvmutil_parseoptlevel(const char *name) {
+    static const char *names[] = {"O0", "O1", "O2", "O3", "Os"};
+    for (int i = 0; i < llvmutil_NOPTLEVELS; i++)
+        if (!strcmp(name, names[i])) return (llvmutil_OptLevel)i;
+    assert(!"unknown optimization level");
+    return llvmutil_O3;
+}
+
+static void setoptlevel(PassManagerBuilder *PMB, llvmutil_OptLevel level) {
+    PMB->OptLevel = (level == llvmutil_Os) ? 2 : level;
+    PMB->SizeLevel = (level == llvmutil_Os) ? 1 : 0;
+}
+
+void llvmutil_addoptimizationpasses(PassManagerBase *fpm, llvmutil_OptLevel level) {
+    if (level == llvmutil_O0) return;
     PassManagerBuilder PMB;
-    PMB.OptLevel = 3;
-    PMB.SizeLevel = 0;
+    setoptlevel(&PMB, level);
     PMB.DisableUnitAtATime = true;
 #if LLVM_VERSION <= 34 && LLVM_VERSION >= 32
     PMB.LoopVectorize = false;
@@ -88,6 +109,80 @@ void llvmutil_addoptimizationpasses(PassManagerBase *fpm) {
     PMB.populateModulePassManager(W);
 }
 
+#if LLVM_VERSION >= 60
+static PassBuilder::OptimizationLevel getpassbuilderlevel(llvmutil_OptLevel level) {
+    switch (level) {
+        case llvmutil_O1:
+            return PassBuilder::O1;
+        case llvmutil_O2:
+            return PassBuilder::O2;
+        case llvmutil_Os:
+            return PassBuilder::Os;
+        default:
+            return PassBuilder::O3;
+    }
+}
+static void registeranalyses(PassBuilder &PB, LoopAnalysisManager &LAM,
+                             FunctionAnalysisManager &FAM, CGSCCAnalysisManager &CGAM,
+                             ModuleAnalysisManager &MAM) {
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+}
+
+struct llvmutil_FunctionOptimizer {
+    PassBuilder PB;
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    llvm::FunctionPassManager FPM;
+    llvmutil_FunctionOptimizer(TargetMachine *TM) : PB(TM) {
+        registeranalyses(PB, LAM, FAM, CGAM, MAM);
+    }
+};
+
+llvmutil_FunctionOptimizer *llvmutil_createfunctionoptimizer(TargetMachine *TM, Module *M,
+                                                             llvmutil_OptLevel level) {
+    llvmutil_FunctionOptimizer *FO = new llvmutil_FunctionOptimizer(TM);
+    if (level == llvmutil_O0) return FO;
+    // the simplification pipeline is what the module pipeline runs on each function
+    // after inlining; the vectorizers normally run later at module level, so they are
+    // added here to match the legacy function pipeline
+    FO->FPM = FO->PB.buildFunctionSimplificationPipeline(
+            getpassbuilderlevel(level), PassBuilder::ThinLTOPhase::None);
+    FO->FPM.addPass(LoopVectorizePass());
+    FO->FPM.addPass(SLPVectorizerPass());
+    FO->FPM.addPass(InstCombinePass());
+    return FO;
+}
+void llvmutil_optimizefunction(llvmutil_FunctionOptimizer *FO, Function *F) {
+    FO->FPM.run(*F, FO->FAM);
+    // F may be changed again (by inlining into it) or deleted, so nothing is kept
+    FO->FAM.invalidate(*F, PreservedAnalyses::none());
+}
+#else
+struct llvmutil_FunctionOptimizer {
+    FunctionPassManagerT FPM;
+    llvmutil_FunctionOptimizer(Module *M) : FPM(M) {}
+};
+
+llvmutil_FunctionOptimizer *llvmutil_createfunctionoptimizer(TargetMachine *TM, Module *M,
+                                                             llvmutil_OptLevel level) {
+    llvmutil_FunctionOptimizer *FO = new llvmutil_FunctionOptimizer(M);
+    llvmutil_addtargetspecificpasses(&FO->FPM, TM);
+    llvmutil_addoptimizationpasses(&FO->FPM, level);
+    FO->FPM.doInitialization();
+    return FO;
+}
+void llvmutil_optimizefunction(llvmutil_FunctionOptimizer *FO, Function *F) {
+    FO->FPM.run(*F);
+}
+#endif
+void llvmutil_freefunctionoptimizer(llvmutil_FunctionOptimizer *FO) { delete FO; }
+
 #if LLVM_VERSION < 50
 struct SimpleMemoryObject : public MemoryObject {
     uint64_t getBase() const { return 0; }
@@ -264,6 +359,12 @@ struct CopyConnectedComponent : public ValueMaterializer {
                 newfn->setComdat(
                         fn->getComdat());  // copyAttributesFrom does not copy comdats
             }
+#if LLVM_VERSION >= 50
+            // src may be a lazily loaded bitcode module (see linkllvm), whose users
+            // read what they copy with llvmutil_materializereachable and report its
+            // errors, so reading a body here cannot fail
+            if (fn->isMaterializable()) cantFail(fn->materialize());
+#endif
             if (!fn->isDeclaration() && newfn->isDeclaration() && copyGlobal(fn, data)) {
                 for (Function::arg_iterator II = newfn->arg_begin(), I = fn->arg_begin(),
                                             E = fn->arg_end();
@@ -295,6 +396,12 @@ struct CopyConnectedComponent : public ValueMaterializer {
                         newGV->setInitializer(cast<Constant>(C));
                     }
                 }
+            } else if (newGV->isDeclaration() && GV->hasInitializer() &&
+                       copyGlobal(GV, data)) {  // fill in a definition left out earlier
+                newGV->setLinkage(GV->getLinkage());
+                newGV->setConstant(GV->isConstant());
+                Value *C = MapValue(GV->getInitializer(), VMap, RF_None, NULL, this);
+                newGV->setInitializer(cast<Constant>(C));
             }
             return newGV;
         } else
@@ -364,6 +471,27 @@ struct CopyConnectedComponent : public ValueMaterializer {
             delete DI;
         }
     }
+#elif LLVM_VERSION >= 50
+    // CloneFunctionInto copies the DISubprogram of each function, and the compile unit
+    // it belongs to, but the code generator only emits DWARF for a module that lists
+    // its compile units in llvm.dbg.cu and has the debug info version flags
+    void CopyDebugMetadata() {
+        if (NamedMDNode *NMD = src->getModuleFlagsMetadata()) {
+            NamedMDNode *New = dest->getOrInsertModuleFlagsMetadata();
+            for (unsigned i = 0; i < NMD->getNumOperands(); i++)
+                New->addOperand(MapMetadata(NMD->getOperand(i), VMap));
+        }
+    }
+    Value *materializeValueForMetadata(Value *V) { return NULL; }
+    void finalize() {
+        // after the functions, so that this finds the compile units they were cloned with
+        if (NamedMDNode *CUN = src->getNamedMetadata("llvm.dbg.cu")) {
+            NamedMDNode *New = dest->getOrInsertNamedMetadata(CUN->getName());
+            for (unsigned i = 0; i < CUN->getNumOperands(); i++)
+                New->addOperand(cast<MDNode>(
+                        MapMetadata(CUN->getOperand(i), VMap, RF_None, NULL, this)));
+        }
+    }
 #else
     void CopyDebugMetadata() {}
     Value *materializeValueForMetadata(Value *V) { return NULL; }
@@ -391,7 +519,64 @@ void llvmutil_copyfrommodule(llvm::Module *Dest, llvm::Module *Src,
 }
 #endif
 
-void llvmutil_optimizemodule(Module *M, TargetMachine *TM) {
+bool llvmutil_materializereachable(GlobalValue *gv, std::string *errmsg) {
+#if LLVM_VERSION >= 50
+    if (!gv->getParent()->getMaterializer()) return true;  // not lazily loaded
+    std::vector<GlobalValue *> todo(1, gv);
+    SmallPtrSet<Value *, 32> visited;
+    visited.insert(gv);
+    std::vector<Constant *> constants;
+    while (!todo.empty()) {
+        GlobalValue *G = todo.back();
+        todo.pop_back();
+        if (Error err = G->materialize()) {
+            *errmsg = toString(std::move(err));
+            return false;
+        }
+        // the values G refers to, the globals among them are read next
+        if (Function *F = dyn_cast<Function>(G)) {
+            if (F->hasPersonalityFn()) constants.push_back(F->getPersonalityFn());
+            for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+                for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I)
+                    for (unsigned i = 0; i < I->getNumOperands(); i++)
+                        if (Constant *C = dyn_cast<Constant>(I->getOperand(i)))
+                            constants.push_back(C);
+        } else if (GlobalVariable *GV = dyn_cast<GlobalVariable>(G)) {
+            if (GV->hasInitializer()) constants.push_back(GV->getInitializer());
+        } else if (GlobalAlias *GA = dyn_cast<GlobalAlias>(G)) {
+            constants.push_back(GA->getAliasee());
+        }
+        while (!constants.empty()) {
+            Constant *C = constants.back();
+            constants.pop_back();
+            if (!visited.insert(C).second) continue;
+            if (GlobalValue *R = dyn_cast<GlobalValue>(C))
+                todo.push_back(R);
+            else
+                for (unsigned i = 0; i < C->getNumOperands(); i++)
+                    constants.push_back(cast<Constant>(C->getOperand(i)));
+        }
+    }
+#endif
+    return true;
+}
+
+void llvmutil_optimizemodule(Module *M, TargetMachine *TM, llvmutil_OptLevel level) {
+#if LLVM_VERSION >= 60
+    PassBuilder PB(TM);
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    registeranalyses(PB, LAM, FAM, CGAM, MAM);
+
+    llvm::ModulePassManager MPM;
+    MPM.addPass(VerifierPass());
+    MPM.addPass(GlobalDCEPass());
+    if (level != llvmutil_O0)
+        MPM.addPass(PB.buildPerModuleDefaultPipeline(getpassbuilderlevel(level)));
+    MPM.run(*M, MAM);
+#else
     PassManagerT MPM;
     llvmutil_addtargetspecificpasses(&MPM, TM);
 
@@ -400,23 +585,25 @@ void llvmutil_optimizemodule(Module *M, TargetMachine *TM) {
                                      // exported functions is still in this module this
                                      // will remove dead functions
 
-    PassManagerBuilder PMB;
-    PMB.OptLevel = 3;
-    PMB.SizeLevel = 0;
+    if (level != llvmutil_O0) {
+        PassManagerBuilder PMB;
+        setoptlevel(&PMB, level);
 #if LLVM_VERSION < 50
-    PMB.Inliner = createFunctionInliningPass(PMB.OptLevel, 0);
+        PMB.Inliner = createFunctionInliningPass(PMB.OptLevel, PMB.SizeLevel);
 #else
-    PMB.Inliner = createFunctionInliningPass(PMB.OptLevel, 0, false);
+        PMB.Inliner = createFunctionInliningPass(PMB.OptLevel, PMB.SizeLevel, false);
 #endif
 
 #if LLVM_VERSION >= 35
-    PMB.LoopVectorize = true;
-    PMB.SLPVectorize = true;
+        PMB.LoopVectorize = true;
+        PMB.SLPVectorize = true;
 #endif
 
-    PMB.populateModulePassManager(MPM);
+        PMB.populateModulePassManager(MPM);
+    }
 
     MPM.run(*M);
+#endif
 }
 
 #if LLVM_VERSION >= 34
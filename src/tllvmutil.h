@@ -5,7 +5,25 @@
 
 void llvmutil_addtargetspecificpasses(llvm::PassManagerBase *fpm,
                                       llvm::TargetMachine *tm);
-void llvmutil_addoptimizationpasses(llvm::PassManagerBase *fpm);
+// optimization levels, in the order of clang's -O0 to -O3 flags, then -Os
+enum llvmutil_OptLevel {
+    llvmutil_O0,
+    llvmutil_O1,
+    llvmutil_O2,
+    llvmutil_O3,
+    llvmutil_Os,
+    llvmutil_NOPTLEVELS
+};
+llvmutil_OptLevel llvmutil_parseoptlevel(const char *name);
+void llvmutil_addoptimizationpasses(llvm::PassManagerBase *fpm, llvmutil_OptLevel level);
+// the per-function pipeline used when functions are optimized as they are emitted. It
+// uses LLVM's new pass manager when it is available and the legacy one otherwise.
+struct llvmutil_FunctionOptimizer;
+llvmutil_FunctionOptimizer *llvmutil_createfunctionoptimizer(llvm::TargetMachine *TM,
+                                                             llvm::Module *M,
+                                                             llvmutil_OptLevel level);
+void llvmutil_optimizefunction(llvmutil_FunctionOptimizer *FO, llvm::Function *F);
+void llvmutil_freefunctionoptimizer(llvmutil_FunctionOptimizer *FO);
 extern "C" void llvmutil_disassemblefunction(void *data, size_t sz, size_t inst);
 bool llvmutil_emitobjfile(llvm::Module *Mod, llvm::TargetMachine *TM,
                           bool outputobjectfile, emitobjfile_t &dest);
@@ -19,7 +37,11 @@ void llvmutil_copyfrommodule(llvm::Module *Dest, llvm::Module *Src,
                              llvm::GlobalValue **gvs, size_t N,
                              llvmutil_Property copyGlobal, void *data);
 #endif
-void llvmutil_optimizemodule(llvm::Module *M, llvm::TargetMachine *TM);
+// reads the bodies of gv and of everything it refers to, if they are in a lazily loaded
+// module; returns false and sets *errmsg if a body cannot be read
+bool llvmutil_materializereachable(llvm::GlobalValue *gv, std::string *errmsg);
+void llvmutil_optimizemodule(llvm::Module *M, llvm::TargetMachine *TM,
+                             llvmutil_OptLevel level);
 #if LLVM_VERSION >= 35
 using std::error_code;
 #else
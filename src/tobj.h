@@ -134,12 +134,12 @@ struct Obj {
     }
     T_Kind kind(const char *field) {
         push();
-        lua_getfield(L, LUA_GLOBALSINDEX, "terra");
-        lua_getfield(L, -1, "kinds");
-        lua_getfield(L, -3, field);
+        lua_pushlightuserdata(L, &terra_kindskey);
+        lua_rawget(L, LUA_REGISTRYINDEX);
+        lua_getfield(L, -2, field);
         lua_gettable(L, -2);
         int k = luaL_checkint(L, -1);
-        pop(4);
+        pop(3);
         return (T_Kind)k;
     }
     void setfield(
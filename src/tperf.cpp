@@ -0,0 +1,208 @@
+/* See Copyright Notice in ../LICENSE.txt */
+
+#include "tperf.h"
+#include "terrastate.h"
+
+#include "llvm/Support/Mutex.h"
+
+#ifdef __linux__
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// the perf map and the jitdump file are per process, so they are shared by all
+// terra_States
+static llvm::sys::Mutex perflock;
+static FILE *perfmap = NULL;
+static int jitdumpfd = -1;
+static void *jitdumpmarker = NULL;
+static uint64_t jitdumpcodeindex = 0;
+
+// record layout from tools/perf/Documentation/jitdump-specification.txt
+enum { JITDUMP_MAGIC = 0x4A695444, JITDUMP_VERSION = 1 };
+enum { JIT_CODE_LOAD = 0, JIT_CODE_DEBUG_INFO = 2 };
+
+struct JitDumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+struct JitDumpRecord {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+struct JitDumpCodeLoad {
+    JitDumpRecord p;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+struct JitDumpDebugInfo {
+    JitDumpRecord p;
+    uint64_t code_addr;
+    uint64_t nr_entry;
+};
+struct JitDumpDebugEntry {
+    uint64_t code_addr;
+    uint32_t line;
+    uint32_t discrim;
+};
+
+static uint64_t perftimestamp() {  // perf record must be run with -k mono to match
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t perfelfmachine() {
+#if defined(__x86_64__)
+    return EM_X86_64;
+#elif defined(__i386__)
+    return EM_386;
+#elif defined(__aarch64__)
+    return EM_AARCH64;
+#elif defined(__arm__)
+    return EM_ARM;
+#elif defined(__powerpc64__)
+    return EM_PPC64;
+#else
+    return EM_NONE;
+#endif
+}
+
+static void closejitdump() {
+    if (jitdumpmarker != MAP_FAILED && jitdumpmarker != NULL)
+        munmap(jitdumpmarker, sysconf(_SC_PAGESIZE));
+    jitdumpmarker = NULL;
+    close(jitdumpfd);
+    jitdumpfd = -1;
+}
+
+// writes all of buf to the jitdump, continuing after short writes and interruptions.
+// if that fails the jitdump is closed, since perf cannot read past a partial record
+static bool jitdumpwrite(const void *buf, size_t size) {
+    const char *p = (const char *)buf;
+    while (size > 0) {
+        ssize_t n = write(jitdumpfd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "terra: could not write jitdump file: %s\n",
+                    n < 0 ? strerror(errno) : "no progress");
+            closejitdump();
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static void openjitdump() {
+    const char *dir = getenv("JITDUMPDIR");
+    char filename[1024];
+    snprintf(filename, sizeof(filename), "%s/jit-%d.dump", dir ? dir : "/tmp",
+             (int)getpid());
+    jitdumpfd = open(filename, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (jitdumpfd == -1) {
+        fprintf(stderr, "terra: could not open jitdump file %s\n", filename);
+        return;
+    }
+    // perf inject finds the dump through this executable mapping of the file
+    jitdumpmarker = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE,
+                         jitdumpfd, 0);
+    JitDumpHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = JITDUMP_MAGIC;
+    header.version = JITDUMP_VERSION;
+    header.total_size = sizeof(header);
+    header.elf_mach = perfelfmachine();
+    header.pid = getpid();
+    header.timestamp = perftimestamp();
+    jitdumpwrite(&header, sizeof(header));
+}
+
+static void writejitdump(const std::string &name, void *addr, uint64_t size,
+                         const std::vector<PerfLineEntry> &lines) {
+    if (!lines.empty()) {  // the line table must precede the code it describes
+        JitDumpDebugInfo info;
+        info.p.id = JIT_CODE_DEBUG_INFO;
+        info.p.timestamp = perftimestamp();
+        info.code_addr = (uint64_t)addr;
+        info.nr_entry = lines.size();
+        size_t total = sizeof(info);
+        for (size_t i = 0; i < lines.size(); i++)
+            total += sizeof(JitDumpDebugEntry) + lines[i].file.size() + 1;
+        info.p.total_size = total;
+        if (!jitdumpwrite(&info, sizeof(info))) return;
+        for (size_t i = 0; i < lines.size(); i++) {
+            JitDumpDebugEntry entry;
+            entry.code_addr = lines[i].addr;
+            entry.line = lines[i].line;
+            entry.discrim = 0;
+            if (!jitdumpwrite(&entry, sizeof(entry)) ||
+                !jitdumpwrite(lines[i].file.c_str(), lines[i].file.size() + 1))
+                return;
+        }
+    }
+    JitDumpCodeLoad load;
+    load.p.id = JIT_CODE_LOAD;
+    load.p.timestamp = perftimestamp();
+    load.p.total_size = sizeof(load) + name.size() + 1 + size;
+    load.pid = getpid();
+    load.tid = syscall(SYS_gettid);
+    load.vma = (uint64_t)addr;
+    load.code_addr = (uint64_t)addr;
+    load.code_size = size;
+    load.code_index = jitdumpcodeindex++;
+    if (jitdumpwrite(&load, sizeof(load)) && jitdumpwrite(name.c_str(), name.size() + 1))
+        jitdumpwrite(addr, size);
+}
+
+void terra_perfwritefunction(terra_State *T, const std::string &name, void *addr,
+                             uint64_t size, const std::vector<PerfLineEntry> &lines) {
+    if (T->options.perf <= 0 || size == 0) return;
+    llvm::sys::ScopedLock lock(perflock);
+    if (!perfmap) {
+        char filename[64];
+        snprintf(filename, sizeof(filename), "/tmp/perf-%d.map", (int)getpid());
+        perfmap = fopen(filename, "a");
+        if (!perfmap) {
+            fprintf(stderr, "terra: could not open perf map %s\n", filename);
+            T->options.perf = 0;
+            return;
+        }
+        if (T->options.perf > 1) openjitdump();
+    }
+    // perf may read the map while we are still running, so each entry is flushed
+    if (fprintf(perfmap, "%" PRIxPTR " %" PRIx64 " %s\n", (uintptr_t)addr, size,
+                name.c_str()) < 0 ||
+        fflush(perfmap) != 0) {
+        fprintf(stderr, "terra: could not write perf map: %s\n", strerror(errno));
+        T->options.perf = 0;
+    }
+    if (jitdumpfd != -1) writejitdump(name, addr, size, lines);
+}
+
+#else
+
+void terra_perfwritefunction(terra_State *T, const std::string &name, void *addr,
+                             uint64_t size, const std::vector<PerfLineEntry> &lines) {}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef tperf_h
+#define tperf_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct terra_State;
+
+struct PerfLineEntry {  // start of the code generated for a source line
+    uint64_t addr;
+    uint32_t line;
+    std::string file;
+};
+
+// record a JIT compiled function for linux perf: an entry in /tmp/perf-<pid>.map when
+// T->options.perf > 0, and its code and line table in a jitdump file when > 1
+void terra_perfwritefunction(struct terra_State *T, const std::string &name, void *addr,
+                             uint64_t size, const std::vector<PerfLineEntry> &lines);
+
+#endif
@@ -0,0 +1,43 @@
+-- aggregate constants are emitted as typed constants that the optimizer can fold
+
+struct Entry {
+	key : int8
+	value : double
+	next : &Entry
+}
+
+local table = constant(terralib.new(Entry[3], {{1, 1.5, nil}, {2, 2.5, nil}, {3, 3.5, nil}}))
+local lut = constant(terralib.new(int[8], {0, 1, 4, 9, 16, 25, 36, 49}))
+
+terra lookup(i : int) return table[i].key + table[i].value end
+terra square(i : int) return lut[i and 7] end
+terra folded() return lut[3] + lut[5] end
+terra address() return &lut[2] == &lut[0] + 2 end
+
+assert(lookup(0) == 2.5)
+assert(lookup(2) == 6.5)
+assert(square(6) == 36)
+assert(folded() == 34)
+assert(address())
+
+-- a constant lookup table becomes a typed initializer instead of a string
+local ir = terralib.saveobj(nil, "llvmir", { folded = folded }, nil, nil, false)
+assert(ir:find("[8 x i32] [i32 0, i32 1, i32 4", 1, true), "lookup table is not a typed constant")
+
+-- the same constant used as a global initializer
+local g = global(Entry[3], table)
+terra readglobal() return g[1].value end
+assert(readglobal() == 2.5)
+
+-- floating point elements keep their exact bits, including NaN payloads
+local ffi = require("ffi")
+local nans = terralib.new(double[1])
+local nanbits = ffi.new("uint64_t", 0x7ff80000) * 0x100000000 + 0x123
+ffi.cast("uint64_t *", nans)[0] = nanbits
+local fnans = terralib.new(float[1])
+ffi.cast("uint32_t *", fnans)[0] = 0x7fc00123
+local dconst, fconst = constant(nans), constant(fnans)
+terra doublebits() var d = dconst[0] return @[&uint64](&d) end
+terra floatbits() var f = fconst[0] return @[&uint32](&f) end
+assert(doublebits() == nanbits)
+assert(floatbits() == 0x7fc00123)
@@ -0,0 +1,44 @@
+-- small-aggregate calls between Terra functions: a mandelbrot kernel whose complex
+-- arithmetic is kept out of line, so every operation is a call passing and
+-- returning a two-double struct.
+-- usage: terra complex.t [SIZE]
+
+local SIZE = tonumber(arg and arg[1]) or 1000
+
+struct Complex { re : double, im : double }
+
+terra add(a : Complex, b : Complex) : Complex
+	return Complex { a.re + b.re, a.im + b.im }
+end
+terra mul(a : Complex, b : Complex) : Complex
+	return Complex { a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re }
+end
+terra norm(a : Complex) : double
+	return a.re * a.re + a.im * a.im
+end
+add:setinlined(false)
+mul:setinlined(false)
+norm:setinlined(false)
+
+terra mandelbrot(size : int) : int64
+	var total : int64 = 0
+	for y = 0, size do
+		for x = 0, size do
+			var c = Complex { 3.0 * x / size - 2.0, 2.0 * y / size - 1.0 }
+			var z = Complex { 0, 0 }
+			var i = 0
+			while i < 100 and norm(z) < 4.0 do
+				z = add(mul(z, z), c)
+				i = i + 1
+			end
+			total = total + i
+		end
+	end
+	return total
+end
+mandelbrot:compile()
+
+local begin = terralib.currenttimeinseconds()
+local total = mandelbrot(SIZE)
+local elapsed = terralib.currenttimeinseconds() - begin
+print(("%dx%d mandelbrot (%d iterations) in %.3f s"):format(SIZE, SIZE, tonumber(total), elapsed))
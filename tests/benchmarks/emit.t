@@ -0,0 +1,32 @@
+-- code generation throughput for deeply nested generated code: each level opens a
+-- block and references variables from every enclosing level.
+-- usage: terra emit.t [DEPTH]
+
+local DEPTH = tonumber(arg and arg[1]) or 300
+
+local function nest(syms, d)
+	if d == 0 then
+		local sum = `0
+		for _, s in ipairs(syms) do sum = `sum + s end
+		return quote return [sum] end
+	end
+	local s = symbol(int, "v"..d)
+	local inner = nest(terralib.newlist { s } .. syms, d - 1)
+	local uses = `0
+	for i = 1, math.min(#syms, 8) do uses = `uses + [syms[i]] end
+	return quote
+		var [s] = a + [uses] + [d]
+		if [s] > 0 then [inner] end
+	end
+end
+
+local terra deep(a : int) : int
+	[nest(terralib.newlist(), DEPTH)]
+	return 0
+end
+deep:gettype()
+
+local begin = terralib.currenttimeinseconds()
+deep:compile()
+local elapsed = terralib.currenttimeinseconds() - begin
+print(("depth %d: emitted and compiled in %.3f s"):format(DEPTH, elapsed))
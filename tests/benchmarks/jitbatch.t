@@ -0,0 +1,28 @@
+-- JIT time for many small specialized functions, compiled one at a time or all at
+-- once with terralib.compile.
+-- usage: terra jitbatch.t [N]
+
+local N = tonumber(arg and arg[1]) or 2000
+
+local function makekernels()
+	local fns = terralib.newlist()
+	for i = 1, N do
+		fns:insert(terra(a : &double, n : int)
+			for j = 0, n do a[j] = a[j] * [i] + [i % 7] end
+		end)
+	end
+	for _, fn in ipairs(fns) do fn:gettype() end -- typecheck outside the timed region
+	return fns
+end
+
+local fns = makekernels()
+local begin = terralib.currenttimeinseconds()
+for _, fn in ipairs(fns) do fn:compile() end
+local single = terralib.currenttimeinseconds() - begin
+
+fns = makekernels()
+begin = terralib.currenttimeinseconds()
+terralib.compile(fns)
+local batch = terralib.currenttimeinseconds() - begin
+
+print(("one at a time %.3f s, batched %.3f s (%.1fx) for %d functions"):format(single, batch, single / batch, N))
@@ -0,0 +1,36 @@
+-- code footprint and call throughput of many small JIT-compiled functions, with code
+-- on a page per object (the default), packed into shared pages, and on huge pages.
+-- usage: terra jitmemory.t [N]
+
+local N = tonumber(arg and arg[1]) or 4000
+
+local function run(name, compact, huge)
+	local cu = terralib.newcompilationunit(terralib.nativetarget, true)
+	cu.compactcode, cu.hugepages = compact, huge
+	local fns = terralib.new((int -> int)[N])
+	local begin = terralib.currenttimeinseconds()
+	for i = 1, N do
+		fns[i - 1] = cu:jitvalue(terra(a : int) : int return a * [i] + 1 end)
+	end
+	local compile = terralib.currenttimeinseconds() - begin
+	-- call the functions in a scrambled order, which stresses the iTLB when they are
+	-- spread over many pages
+	local terra dispatch(fns : &(int -> int), n : int, rounds : int)
+		var s = 0
+		for r = 0, rounds do
+			for i = 0, n do s = s + fns[(i * 7919) % n](i) end
+		end
+		return s
+	end
+	dispatch(fns, N, 1)
+	begin = terralib.currenttimeinseconds()
+	dispatch(fns, N, 200)
+	local calls = terralib.currenttimeinseconds() - begin
+	local report = cu:jitmemoryreport()
+	print(("%-8s compile %.3f s  calls %.3f s  code pages %d  protections %d"):format(
+		name, compile, calls, math.ceil(report.code.used / 4096), report.protections))
+end
+
+run("paged", false, false)
+run("compact", true, false)
+run("huge", false, true)
@@ -0,0 +1,35 @@
+-- effect of loop hints on a float reduction that LLVM will not vectorize on its own
+-- because it cannot reorder the additions.
+-- usage: terra loophints.t [N]
+
+local N = tonumber(arg and arg[1]) or 1024*1024
+
+local function makesum(hints)
+	return terra(a : &float, n : int) : float
+		var s : float = 0
+		escape
+			local loop = quote for i = 0, n do s = s + a[i] end end
+			emit(hints and terralib.loophint(hints, loop) or loop)
+		end
+		return s
+	end
+end
+
+local variants = {
+	{ "plain", makesum() },
+	{ "unroll=8", makesum { unroll = 8 } },
+	{ "width=8", makesum { vectorize = true, vectorizewidth = 8 } },
+	{ "width=8x4", makesum { vectorize = true, vectorizewidth = 8, interleave = 4 } },
+}
+
+local a = terralib.new(float[N])
+for i = 0, N - 1 do a[i] = 1 end
+
+for _, v in ipairs(variants) do
+	local name, fn = v[1], v[2]
+	fn(a, N)
+	local begin = terralib.currenttimeinseconds()
+	for i = 1, 100 do fn(a, N) end
+	local elapsed = terralib.currenttimeinseconds() - begin
+	print(("%-10s %.3f ms/call"):format(name, elapsed * 10))
+end
@@ -0,0 +1,37 @@
+-- compile time against run time at each optimization level: JIT-compiles N copies of
+-- a small numeric kernel in a fresh compilation unit per level, then times one of them.
+-- usage: terra optlevels.t [N]
+
+local N = tonumber(arg and arg[1]) or 200
+local M = 1024
+
+local function makekernel()
+	return terra(a : &double, b : &double, n : int) : double
+		var s = 0.0
+		for i = 0, n do
+			for j = 0, n do
+				s = s + a[i] * b[j] / (1.0 + i + j)
+			end
+		end
+		return s
+	end
+end
+
+local a, b = terralib.new(double[M]), terralib.new(double[M])
+for i = 0, M - 1 do a[i], b[i] = i, M - i end
+
+for _, level in ipairs { "O0", "O1", "O2", "O3", "Os" } do
+	local cu = terralib.newcompilationunit(terralib.nativetarget, true)
+	cu.optlevel = level
+	local begin = terralib.currenttimeinseconds()
+	local fn
+	for i = 1, N do
+		fn = cu:jitvalue(makekernel())
+	end
+	local compile = terralib.currenttimeinseconds() - begin
+	fn = terralib.cast({&double, &double, int} -> double, fn)
+	begin = terralib.currenttimeinseconds()
+	fn(a, b, M)
+	local run = terralib.currenttimeinseconds() - begin
+	print(("%-3s compile %.3f ms/function  run %.3f ms"):format(level, compile / N * 1000, run * 1000))
+end
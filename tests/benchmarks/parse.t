@@ -0,0 +1,39 @@
+-- parser throughput: generates a large Terra source file and reports how fast
+-- terralib.loadstring parses it. The chunk is never run, so nothing is typechecked.
+-- usage: terra parse.t [N] [repeats]
+
+local N = tonumber(arg and arg[1]) or 2000
+local R = tonumber(arg and arg[2]) or 10
+
+local parts = {}
+for i = 1, N do
+	parts[#parts + 1] = ([[
+local terra function%d(alpha%d : int, beta : double, gamma : &int) : double
+	var accumulator = beta
+	for index = 0, alpha%d do
+		if index %% 3 == 0 and gamma ~= nil then
+			accumulator = accumulator + gamma[index] * [double](index)
+		elseif index %% 3 == 1 then
+			accumulator = accumulator - beta / (index + 1.5)
+		else
+			var temporary : double[4]
+			temporary[index %% 4] = accumulator
+			accumulator = temporary[index %% 4] * 0.5
+		end
+	end
+	return accumulator -- identifier%d
+end
+local value%d = { name = "function%d", fn = function%d, count = %d }
+]]):format(i, i, i, i, i, i, i, i)
+end
+local code = table.concat(parts)
+local lines = select(2, code:gsub("\n", "\n"))
+
+local begin = terralib.currenttimeinseconds()
+for r = 1, R do
+	assert(terralib.loadstring(code, "parse"))
+end
+local elapsed = (terralib.currenttimeinseconds() - begin) / R
+
+print(("%d lines, %d bytes in %.3f s: %.0f lines/s, %.1f MB/s"):format(
+	lines, #code, elapsed, lines / elapsed, #code / elapsed / 1e6))
@@ -0,0 +1,37 @@
+-- effect of noalias parameters and strict aliasing on a naive matrix multiply:
+-- without them LLVM must assume C may overlap A and B, which blocks vectorization.
+-- usage: terra restrict.t [N]
+
+local N = tonumber(arg and arg[1]) or 512
+
+local function makegemm()
+	return terra(n : int, A : &double, B : &double, C : &double)
+		for i = 0, n do
+			for k = 0, n do
+				for j = 0, n do
+					C[i*n + j] = C[i*n + j] + A[i*n + k] * B[k*n + j]
+				end
+			end
+		end
+	end
+end
+
+local plain, restricted = makegemm(), makegemm()
+restricted:setnoalias("A", "B", "C")
+local strict = makegemm()
+local strictcu = terralib.newcompilationunit(terralib.nativetarget, true)
+strictcu.strictaliasing = true
+local strictptr = terralib.cast({int, &double, &double, &double} -> {}, strictcu:jitvalue(strict))
+
+local A, B, C = terralib.new(double[N*N]), terralib.new(double[N*N]), terralib.new(double[N*N])
+
+local function time(name, fn)
+	fn(N, A, B, C)
+	local begin = terralib.currenttimeinseconds()
+	fn(N, A, B, C)
+	local elapsed = terralib.currenttimeinseconds() - begin
+	print(("%-12s %.3f s  %.2f GFLOPS"):format(name, elapsed, 2 * N * N * N / elapsed / 1e9))
+end
+time("plain", plain)
+time("noalias", restricted)
+time("strict", strictptr)
@@ -0,0 +1,26 @@
+-- JIT compilation of many small functions over the same struct types. Each function
+-- is compiled separately, so this measures the per-compilation overhead of laying
+-- out and classifying the types it uses.
+-- usage: terra smallfunctions.t [N]
+
+local N = tonumber(arg and arg[1]) or 2000
+
+struct Vec3 { x : float, y : float, z : float }
+struct Pair { a : Vec3, b : Vec3, w : double }
+struct Big { data : double[16], tag : int }
+
+local fns = terralib.newlist()
+for i = 1, N do
+	fns:insert(terra(p : Pair, q : &Big, v : Vec3) : Pair
+		var r = p
+		r.a.x = v.x + [i]
+		r.w = q.data[[i % 16]] + r.b.z
+		return r
+	end)
+end
+for _, fn in ipairs(fns) do fn:gettype() end
+
+local begin = terralib.currenttimeinseconds()
+for _, fn in ipairs(fns) do fn:compile() end
+local elapsed = terralib.currenttimeinseconds() - begin
+print(("%d functions compiled in %.3f s: %.0f functions/s"):format(N, elapsed, N / elapsed))
@@ -0,0 +1,24 @@
+-- startup time: runs the terra executable N times with an empty chunk, and with a
+-- chunk that compiles a function, and reports the average time per process.
+-- usage: terra startup.t [N]
+
+local N = tonumber(arg and arg[1]) or 20
+
+local i = 0
+while arg[i - 1] do i = i - 1 end
+local exe = arg[i]
+
+local function timeit(chunk)
+	local cmd = ("%q -e %q"):format(exe, chunk)
+	local begin = terralib.currenttimeinseconds()
+	for _ = 1, N do
+		local r = os.execute(cmd)
+		assert(r == 0 or r == true, "failed to run "..cmd)
+	end
+	return (terralib.currenttimeinseconds() - begin) / N
+end
+
+local empty = timeit("")
+local jit = timeit("terra f() return 1 end assert(f() == 1)")
+print(("terra -e '': %.1f ms per process"):format(empty * 1000))
+print(("terra -e with one JIT'd function: %.1f ms per process"):format(jit * 1000))
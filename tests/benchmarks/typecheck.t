@@ -0,0 +1,65 @@
+-- typechecking throughput: generates a metaprogram of N functions and
+-- reports how many typed tree nodes per second the typechecker produces.
+-- usage: terra typecheck.t [N]
+
+local N = tonumber(arg and arg[1]) or 10000
+
+struct Point {
+	x : double;
+	y : double;
+}
+
+local function makefunction(prev, i)
+	return terra(a : int, b : double) : double
+		var s = b
+		var p = Point { [double](a), b }
+		for j = 0, a do
+			if j % 3 == 0 then
+				s = s + j * p.x
+			elseif j % 3 == 1 then
+				s = s - [double](j) / (p.y + 1.0)
+			else
+				var t : double[4]
+				t[j % 4] = s
+				s = t[j % 4] * 0.5
+			end
+		end
+		while s > [i] do
+			s = s / 2
+		end
+		escape
+			if prev then emit quote s = s + prev(a - 1, b * 0.5) end end
+		end
+		return s + p.x * p.y
+	end
+end
+
+local function countnodes(tree, seen)
+	if seen[tree] then return 0 end
+	seen[tree] = true
+	local n = 1
+	for k, v in pairs(tree) do
+		if terralib.istree(v) then
+			n = n + countnodes(v, seen)
+		elseif terralib.israwlist(v) then
+			for _, e in ipairs(v) do
+				if terralib.istree(e) then n = n + countnodes(e, seen) end
+			end
+		end
+	end
+	return n
+end
+
+local fns = terralib.newlist()
+local begin = terralib.currenttimeinseconds()
+for i = 1, N do
+	fns:insert(makefunction(fns[i - 1], i))
+end
+local elapsed = terralib.currenttimeinseconds() - begin
+
+local nodes, seen = 0, {}
+for _, fn in ipairs(fns) do
+	nodes = nodes + countnodes(fn.definition.body, seen)
+end
+
+print(("%d functions, %d nodes in %.3f s: %.0f nodes/s"):format(N, nodes, elapsed, nodes / elapsed))
@@ -0,0 +1,21 @@
+-- terralib.compile jits a list of functions together
+
+local fns = terralib.newlist()
+for i = 1, 20 do
+	fns:insert(terra(a : int) : int return a * [i] end)
+end
+local g = global(int, 7)
+terra useg() return g end
+fns:insert(useg)
+
+local first = fns[1]:compile()
+local ptrs = terralib.compile(fns)
+assert(#ptrs == #fns)
+assert(ptrs[1] == first) -- already compiled values are kept
+for i = 1, 20 do
+	assert(fns[i]:compile() == ptrs[i])
+	assert(fns[i](2) == 2 * i)
+end
+assert(useg() == 7)
+
+assert(not pcall(terralib.compile, { 1 }))
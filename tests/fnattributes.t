@@ -0,0 +1,31 @@
+-- function attributes set with setattributes
+
+terra fail(code : int) : int
+	return code * 2
+end
+fail:setattributes { cold = true, minsize = true, align = 64, inline = false }
+
+terra kernel(a : &float, n : int)
+	for i = 0, n do a[i] = a[i] * 2 end
+end
+kernel:setattributes { hot = true, targetfeatures = "+avx2", optlevel = "O3" }
+
+local ir = terralib.saveobj(nil, "llvmir", { fail = fail, kernel = kernel }, nil, nil, false)
+assert(ir:match("define[^\n]*@fail[^\n]*align 64"))
+assert(ir:match("minsize") and ir:match("noinline") and ir:match("inlinehint"))
+if terralib.llvmversion >= 37 then
+	assert(ir:match("\"target%-features\"=\"[^\"]*%+avx2\""))
+end
+assert(fail(21) == 42)
+
+assert(not pcall(function() fail:setattributes { fast = true } end))
+assert(not pcall(function() fail:setattributes { align = 3 } end))
+assert(not pcall(function() fail:setattributes { cold = "yes" } end))
+assert(not pcall(function() fail:setattributes { hot = true } end)) -- already cold
+-- a table that fails to validate changes nothing
+local ok, msg = pcall(function() fail:setattributes { align = 16, hot = true } end)
+assert(not ok and msg:match("both hot and cold"))
+assert(not pcall(function() fail:setattributes { minsize = false, optlevel = "O9" } end))
+assert(fail.definition.align == 64 and fail.definition.minsize == true)
+fail:setattributes { hot = true, cold = false }
+assert(fail.definition.hot and not fail.definition.cold)
@@ -0,0 +1,47 @@
+local ffi = require("ffi")
+if ffi.os ~= "Linux" or terralib.llvmversion < 50 then return end
+--this test needs debug level 2 (-g -g), if it is not on, relaunch with it on
+if terralib.isdebug < 2 then
+  local r = os.execute(terralib.terrahome.."/bin/terra -g -g gdbjit.t")
+  assert(r == 0 or r == true)
+  return
+end
+
+-- the interface gdb and lldb read JIT objects from, see "JIT Interface" in the gdb manual
+ffi.cdef [[
+struct jit_code_entry {
+    struct jit_code_entry *next_entry;
+    struct jit_code_entry *prev_entry;
+    const char *symfile_addr;
+    uint64_t symfile_size;
+};
+struct jit_descriptor {
+    uint32_t version;
+    uint32_t action_flag;
+    struct jit_code_entry *relevant_entry;
+    struct jit_code_entry *first_entry;
+};
+extern struct jit_descriptor __jit_debug_descriptor;
+]]
+local descriptor = ffi.C.__jit_debug_descriptor
+local function entries()
+    local n, e = 0, descriptor.first_entry
+    while e ~= nil do
+        n, e = n + 1, e.next_entry
+    end
+    return n
+end
+
+local before = entries()
+terra inner(a : int) return a + 1 end
+terra outer(a : int) return inner(a) * 2 end
+inner:setinlined(false)
+assert(outer(1) == 4)
+assert(entries() > before)
+
+-- the last registered object is an ELF file that carries the DWARF of the functions
+local e = descriptor.relevant_entry
+local object = ffi.string(e.symfile_addr, e.symfile_size)
+assert(object:sub(1,4) == "\127ELF")
+assert(object:find(".debug_info",1,true) and object:find(".debug_line",1,true))
+assert(object:find("outer",1,true))
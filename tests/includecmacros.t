@@ -0,0 +1,23 @@
+-- macros are evaluated when they are first used
+local C,tagged,macros = terralib.includecstring [[
+#define BAR 7
+#define NEG -2
+#define NOTANUMBER "hello"
+#define FUNCTIONLIKE(x) 1
+int BAZ(int a) { return a; }
+]]
+
+assert(rawget(macros,"BAR") == nil)
+assert(macros.BAR == 7)
+assert(rawget(macros,"BAR") == 7)
+assert(C.NEG == -2)
+assert(macros.NOTANUMBER == nil)
+assert(macros.FUNCTIONLIKE == nil)
+-- declarations still take precedence
+assert(terralib.isfunction(C.BAZ))
+
+local success,msg = pcall(function() return C.NOTANUMBER end)
+assert(not success and msg:match("not found"))
+
+terra usesbar() return C.BAR + C.NEG end
+assert(usesbar() == 5)
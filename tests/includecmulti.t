@@ -0,0 +1,13 @@
+local headers = terralib.includecmulti({"stdio.h", "math.h", "mytest.h"}, {"-I."})
+assert(#headers == 3)
+local stdio, cmath, c = unpack(headers)
+
+terra foo()
+    var a : int = 3
+    stdio.printf("%f\n", cmath.sqrt(16.0))
+    return c.myfoobarthing(1,2,3.5,&a) + a + [int](cmath.sqrt(16.0))
+end
+
+local test = require("test")
+test.eq(foo(),19)
+test.eq(c.myotherthing(1,2),3)
@@ -0,0 +1,26 @@
+local C = terralib.includecstring [[
+    int counter;
+    int bump(void) { return ++counter; }
+    static inline int twice(int a) { return 2*a; }
+]]
+
+terra a() return C.bump() end
+terra b() return C.twice(C.bump()) end
+
+-- bump and counter are compiled once for the target and shared by every caller
+assert(a() == 1)
+assert(b() == 4)
+assert(a() == 3)
+
+local cu = terralib.newcompilationunit(terralib.nativetarget,false)
+cu:addvalue("b",b)
+local report = cu:memoryreport()
+assert(#report >= 2)
+for i,m in ipairs(report) do
+    assert(type(m.name) == "string" and m.functions >= m.definitions)
+end
+
+-- saved objects get their own copy of the C definitions
+local bc = cu:saveobj(nil,"llvmir")
+assert(bc:match("define[^\n]*@bump"))
+cu:free()
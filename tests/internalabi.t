@@ -0,0 +1,46 @@
+-- calls between Terra functions pass small aggregates as values, while Lua and
+-- function pointers still go through the C ABI entry point
+
+struct Complex { re : double, im : double }
+struct Vec3 { x : float, y : float, z : float }
+struct Big { data : double[16] }
+
+terra cmul(a : Complex, b : Complex) : Complex
+	return Complex { a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re }
+end
+cmul:setinlined(false)
+
+terra cpow(a : Complex, n : int) : Complex
+	if n == 0 then return Complex { 1, 0 } end
+	return cmul(a, cpow(a, n - 1))
+end
+
+terra scale(v : Vec3, s : float) : Vec3
+	return Vec3 { v.x * s, v.y * s, v.z * s }
+end
+terra sum(v : Vec3) return v.x + v.y + v.z end
+
+terra bigsum(b : Big) : double
+	var s = 0.0
+	for i = 0, 16 do s = s + b.data[i] end
+	return s
+end
+
+terra viapointer(a : Complex, b : Complex) : Complex
+	var f : {Complex, Complex} -> Complex = cmul
+	return f(a, b)
+end
+
+terra run() : double
+	var c = cpow(Complex { 0, 1 }, 2)
+	var b : Big
+	for i = 0, 16 do b.data[i] = i end
+	return c.re + sum(scale(Vec3 { 1, 2, 3 }, 2)) + bigsum(b)
+end
+
+assert(run() == -1 + 12 + 120)
+local c = cmul({ 1, 2 }, { 3, 4 })
+assert(c.re == -5 and c.im == 10)
+local p = viapointer({ 1, 2 }, { 3, 4 })
+assert(p.re == -5 and p.im == 10)
+assert(scale({ 1, 1, 1 }, 3).y == 3)
@@ -0,0 +1,26 @@
+-- JIT memory is bump allocated from shared regions and reported per compilation unit
+
+local function compilemany(cu, n)
+	local ptrs = {}
+	for i = 1, n do
+		local fn = terra(a : int) : int return a + [i] end
+		ptrs[i] = terralib.cast({int} -> int, cu:jitvalue(fn))
+	end
+	for i = 1, n do assert(ptrs[i](1) == i + 1) end
+end
+
+local paged = terralib.newcompilationunit(terralib.nativetarget, true)
+assert(paged:jitmemoryreport() == nil)
+compilemany(paged, 50)
+local compact = terralib.newcompilationunit(terralib.nativetarget, true)
+compact.compactcode = true
+compilemany(compact, 50)
+
+local a, b = paged:jitmemoryreport(), compact:jitmemoryreport()
+if a then
+	assert(a.code.regions >= 1 and a.code.allocated > 0)
+	assert(a.code.used >= a.code.allocated and a.code.reserved >= a.code.used)
+	-- 50 small functions share pages instead of taking one each
+	assert(b.code.used < a.code.used)
+	assert(b.code.used < 50 * 4096)
+end
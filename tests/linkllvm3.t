@@ -0,0 +1,42 @@
+terra add(a : int, b : int)
+    return a + b
+end
+terra sub(a : int, b : int)
+    return a - b
+end
+terra unused(a : int)
+    return a * a
+end
+
+terralib.saveobj("addsub.bc","bitcode",{ add = add, sub = sub, unused = unused })
+
+-- linking the same unchanged file again is a no-op
+local lib = terralib.linkllvm("addsub.bc")
+local lib2 = terralib.linkllvm("addsub.bc")
+add2 = lib:extern("add", {int,int} -> int)
+sub2 = lib2:extern("sub", {int,int} -> int)
+
+terra both(a : int, b : int)
+    return add2(a,b) * sub2(a,b)
+end
+
+assert(add2(3,4) == 7)
+assert(sub2(3,4) == -1)
+assert(both(5,3) == 16)
+
+if terralib.llvmversion >= 50 then
+    -- only the bodies reachable from the externs that were used have been read
+    local loaded = lib:loadedfunctions()
+    assert(loaded.add and loaded.sub and not loaded.unused)
+
+    -- a rewritten file is read again, even within the same second as the first one
+    terra mul(a : int, b : int)
+        return a * b
+    end
+    terralib.saveobj("addsub.bc","bitcode",{ add = add, sub = sub, unused = unused, mul = mul })
+    local lib3 = terralib.linkllvm("addsub.bc")
+    assert(not lib3:loadedfunctions().add)
+    mul2 = lib3:extern("mul", {int,int} -> int)
+    assert(mul2(3,4) == 12)
+    assert(lib3:loadedfunctions().mul)
+end
@@ -0,0 +1,35 @@
+-- loop hints become llvm.loop metadata on the loop back edge
+
+terra sum(a : &int, n : int)
+	var s = 0
+	[terralib.loophint({ unroll = 4 }, quote
+		for i = 0, n do s = s + a[i] end
+	end)]
+	return s
+end
+
+terra halve(n : int)
+	var c = 0
+	[terralib.loophint({ vectorize = false, interleave = 2 }, quote
+		while n > 1 do n = n / 2; c = c + 1 end
+	end)]
+	repeat
+		n = n + 1
+	until n > 10
+	return c + n
+end
+
+local ir = terralib.saveobj(nil, "llvmir", { sum = sum, halve = halve }, nil, nil, false)
+assert(ir:match("llvm.loop.unroll.count"))
+assert(ir:match("llvm.loop.vectorize.width"))
+assert(select(2, ir:gsub("!llvm.loop", "")) == 2, "only the hinted loops carry metadata")
+
+local a = terralib.new(int[5], {1, 2, 3, 4, 5})
+assert(sum(a, 5) == 15)
+assert(halve(8) == 14)
+
+local loop = quote for i = 0, 10 do end end
+assert(not pcall(terralib.loophint, { unroll = 0 }, loop))
+assert(not pcall(terralib.loophint, { unrol = 2 }, loop))
+assert(not pcall(terralib.loophint, { vectorize = 4 }, loop))
+assert(not pcall(terralib.loophint, { unroll = 2 }, quote var x = 1 end))
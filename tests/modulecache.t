@@ -0,0 +1,54 @@
+-- require saves the parsed form of .t modules and uses it on the next load
+
+local base = os.tmpname()
+local dir, name = base:match("^(.*)[/\\]([^/\\]*)$")
+local source = base..".t"
+local handle = io.open(source,"w")
+handle:write [[
+local M = {}
+struct M.Pair { a : int, b : int }
+terra M.sum(p : M.Pair) return p.a + p.b end
+M.scale = 3
+terra M.scaled(x : int) return x * [M.scale] end
+return M
+]]
+handle:close()
+
+local oldpath = package.terrapath
+package.terrapath = dir.."/?.t"
+terralib.usemodulecache = true
+terralib.cachedirectory = nil
+
+local parses = 0
+local loadfile = terralib.loadfile
+terralib.loadfile = function(...)
+    parses = parses + 1
+    return loadfile(...)
+end
+
+local first = require(name)
+assert(first.sum({1,2}) == 3)
+assert(parses == 1)
+local cache = io.open(source.."c","rb")
+assert(cache, "module cache was not written")
+local key = cache:read("*a"):match("^TERRATC1\n[^\n]*\n[^\n]*\n([^\n]*)\n")
+cache:close()
+assert(terralib._trees[key])
+
+-- load the module again from the cache, as a new process would: its trees are not
+-- in terralib._trees yet
+terralib._trees[key] = nil
+package.loaded[name] = nil
+local second = require(name)
+assert(parses == 1, "module was parsed again instead of loaded from the cache")
+assert(terralib._trees[key])
+assert(second ~= first)
+assert(second.sum({3,4}) == 7)
+assert(second.scaled(2) == 6)
+
+terralib.loadfile = loadfile
+terralib.usemodulecache = false
+package.terrapath = oldpath
+os.remove(source)
+os.remove(source.."c")
+os.remove(base)
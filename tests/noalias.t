@@ -0,0 +1,35 @@
+-- noalias parameters and strict aliasing metadata
+
+terra axpy(n : int, a : double, x : &double, y : &double)
+	for i = 0, n do
+		y[i] = y[i] + a * x[i]
+	end
+end
+axpy:setnoalias("x", 4)
+
+local ir = terralib.saveobj(nil, "llvmir", { axpy = axpy }, nil, nil, false)
+local header = ir:match("define[^\n]*@axpy%(([^\n]*)%)")
+assert(select(2, header:gsub("noalias", "")) == 2, "expected two noalias parameters")
+
+assert(not pcall(function() axpy:setnoalias("n") end)) -- not a pointer
+assert(not pcall(function() axpy:setnoalias("z") end)) -- not a parameter
+
+local x, y = terralib.new(double[4], {1, 2, 3, 4}), terralib.new(double[4], {1, 1, 1, 1})
+axpy(4, 2, x, y)
+assert(y[3] == 9)
+
+-- type-based alias metadata is only emitted when asked for
+terra store(p : &int, q : &float) : int
+	@p = 1
+	@q = 2
+	return @p
+end
+assert(not terralib.saveobj(nil, "llvmir", { store = store }, nil, nil, false):match("!tbaa"))
+local cu = terralib.newcompilationunit(terralib.nativetarget, false)
+cu.strictaliasing = true
+cu:addvalue("store", store)
+local strict = cu:saveobj(nil, "llvmir", {}, false)
+cu:free()
+assert(strict:match("!tbaa"))
+local p, q = terralib.new(int[1]), terralib.new(float[1])
+assert(store(p, q) == 1)
@@ -0,0 +1,28 @@
+-- optimization levels per compilation unit and per function
+
+local function makesum()
+	return terra(n : int) : int
+		var s = 0
+		for i = 0, n do s = s + i end
+		return s
+	end
+end
+
+for _, level in ipairs { "O0", "O1", "O2", "O3", "Os" } do
+	local cu = terralib.newcompilationunit(terralib.nativetarget, true)
+	cu.optlevel = level
+	local sum = terralib.cast({int} -> int, cu:jitvalue(makesum()))
+	assert(sum(10) == 45)
+end
+
+local cold, small = makesum(), makesum()
+cold:setoptlevel("O0")
+small:setoptlevel("Os")
+assert(cold(10) == 45 and small(10) == 45)
+
+-- the function's own level survives whole-module optimization in saveobj
+local ir = terralib.saveobj(nil, "llvmir", { cold = cold, small = small }, nil, nil, "O2")
+assert(ir:match("optnone") and ir:match("optsize"))
+
+assert(not pcall(function() cold:setoptlevel("O4") end))
+assert(not pcall(function() terralib.saveobj(nil, "llvmir", { cold = cold }, nil, nil, "fast") end))
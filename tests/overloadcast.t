@@ -0,0 +1,45 @@
+-- speculative __cast failures are not retried for the same argument while resolving
+-- one overloaded call, but are asked again for later calls
+
+struct A { a : int }
+struct B { b : double }
+
+local calls = {}
+function A.metamethods.__cast(from,to,exp)
+	local key = tostring(from).."->"..tostring(to)
+	calls[key] = (calls[key] or 0) + 1
+	if from == A and to == int then
+		return `exp.a
+	end
+	error("no conversion from "..tostring(from).." to "..tostring(to))
+end
+
+local foo = terralib.overloadedfunction("foo")
+foo:adddefinition(terra(x : int, y : int) return 1 end)
+foo:adddefinition(terra(x : B, y : int) return 2 end)
+foo:adddefinition(terra(x : B, y : double) return 3 end)
+
+for i = 1,10 do
+	local terra testit()
+		var a, a2 = A { 5 }, A { 6 }
+		return foo(a, 1) + foo(a2, 1)
+	end
+	assert(testit() == 2)
+end
+
+-- once for each argument in each function: the second definition taking a B
+-- does not ask again
+assert(calls["A->int"] == 20)
+assert(calls["A->B"] == 20)
+
+-- a rejected conversion still reports the error from __cast when it is required
+local terra needsB(x : B) return x.b end
+local success, msg = pcall(function()
+	local terra bad()
+		var a = A { 5 }
+		return needsB(a)
+	end
+	bad:compile()
+end)
+assert(not success)
+assert(msg:match("no conversion from A to B"))
@@ -0,0 +1,25 @@
+local ffi = require("ffi")
+if ffi.os ~= "Linux" or terralib.llvmversion <= 40 then return end
+--this test needs -P, if it is not on, relaunch with it on
+if 0 == terralib.isperf then
+  local r = os.execute(terralib.terrahome.."/bin/terra -P perfmap.t")
+  assert(r == 0 or r == true)
+  return
+end
+
+ffi.cdef "int getpid(void);"
+
+terra perfmapped(a : int)
+    return a * 3
+end
+assert(perfmapped(2) == 6)
+
+-- the JIT compiled function has an entry "<address> <size> <name>" in the perf map
+local mapfile = ("/tmp/perf-%d.map"):format(ffi.C.getpid())
+local handle = assert(io.open(mapfile))
+local map = handle:read("*a")
+handle:close()
+local addr = map:match("(%x+) %x+ [^\n]*perfmapped[^\n]*\n")
+assert(addr, "no perf map entry for perfmapped")
+assert(tonumber(addr,16) == tonumber(ffi.cast("uintptr_t",perfmapped:getpointer())))
+os.remove(mapfile)
@@ -0,0 +1,31 @@
+if not terralib.profilerstart then return end
+
+terra spin(n : int) : double
+    var s = 0.0
+    for i = 0,n do
+        s = s + [double](i) / (s + 1.0)
+    end
+    return s
+end
+spin:compile()
+
+-- about 100 ms of samples, however fast the machine is
+local function spinfor()
+    local s,begin = 0,terralib.currenttimeinseconds()
+    repeat
+        s = s + spin(1000000)
+    until terralib.currenttimeinseconds() - begin > 0.1
+    return s
+end
+
+local p,r = terralib.profile(spinfor, { interval = 500 })
+assert(type(r) == "number")
+assert(#p.samples > 0)
+
+local found = false
+for _,e in ipairs(p:flat()) do
+    if e.name:match("spin") then found = true end
+end
+assert(found)
+assert(p:collapsed():match("spin[^\n]* %d+\n"))
+assert(p:report("tree"):match("spin"))
@@ -0,0 +1,51 @@
+if not terralib.profilerstart or terralib.llvmversion < 50 then return end
+--this test require debug on, if it is not on, relaunch with it on
+if 0 == terralib.isdebug then
+  local r = os.execute(terralib.terrahome.."/bin/terra -g profilelines.t")
+  assert(r == 0 or r == true)
+  return
+end
+
+terra spin(n : int) : double
+    var s = 0.0
+    for i = 0,n do
+        s = s + [double](i) / (s + 1.0)
+    end
+    return s
+end
+spin:compile()
+
+-- about 100 ms of samples, however fast the machine is
+local function spinfor()
+    local s,begin = 0,terralib.currenttimeinseconds()
+    repeat
+        s = s + spin(1000000)
+    until terralib.currenttimeinseconds() - begin > 0.1
+    return s
+end
+
+-- samples in spin are attributed to the lines of its body
+local p = terralib.profile(spinfor, { interval = 500 })
+local found = false
+for _,loc in ipairs(p.locations) do
+    if loc.name:match("spin") and loc.line then
+        assert(loc.file:match("profilelines.t$"))
+        assert(loc.line >= 9 and loc.line <= 15)
+        found = true
+    end
+end
+assert(found)
+assert(p:report("flat",true):match("spin %(.*profilelines.t:%d+%)"))
+
+-- and so is the address lookup used by stack traces
+local ptr = terralib.cast(rawstring,spin:getpointer())
+terra findline(a : &opaque)
+    var si : terralib.SymbolInfo
+    var li : terralib.LineInfo
+    if not terralib.lookupsymbol(a,&si) or not terralib.lookupline(si.addr,a,&li) then
+        return 0
+    end
+    return [int](li.linenum)
+end
+local line = findline(ptr + 1)
+assert(line >= 9 and line <= 15)
@@ -0,0 +1,83 @@
+-- redefining a function after it has been compiled recompiles it and its callers
+
+terra leaf(a : int) : int
+    return a + 1
+end
+leaf:setredefinable(true)
+
+terra caller(a : int)
+    return leaf(a) * 2
+end
+
+terra unrelated(a : int)
+    return a - 1
+end
+
+assert(caller(3) == 8)
+assert(unrelated(3) == 2)
+local unrelatedptr = unrelated:compile()
+local oldleaf = leaf:getpointer()
+
+local unredirected = leaf:resetdefinition(terra(a : int) : int
+    return a + 10
+end)
+
+assert(leaf(3) == 13)
+assert(caller(3) == 26)
+-- leaf is only a few bytes of code, but it is redefinable, so its old entry point
+-- is redirected too
+local ffi = require("ffi")
+local canredirect = ffi.arch == "x64" and terralib.llvmversion >= 36
+if canredirect then
+    assert(#unredirected == 0)
+    assert(oldleaf(3) == 13)
+else
+    assert(unredirected:find(function(f) return f == leaf end))
+    assert(oldleaf(3) == 4)
+end
+-- functions that do not use leaf keep their code
+assert(unrelated:compile() == unrelatedptr)
+
+-- functions with small struct parameters are called through an internal entry point
+-- unless they are redefinable
+struct Pair { a : int, b : int }
+terra sum(p : Pair) : int
+    return p.a + p.b
+end
+terra product(p : Pair) : int
+    return p.a * p.b
+end
+sum:setredefinable(true)
+terra callboth(a : int) : int
+    var p = Pair { a, 2 }
+    return sum(p) + product(p)
+end
+assert(callboth(3) == 11)
+local P = terralib.new(Pair, {3, 2})
+local oldsum = sum:getpointer()
+
+local function isin(list, fn)
+    return list:find(function(f) return f == fn end) ~= nil
+end
+unredirected = sum:resetdefinition(terra(p : Pair) : int
+    return p.a - p.b
+end)
+assert(sum(P) == 1)
+assert(callboth(3) == 7)
+if canredirect then
+    assert(not isin(unredirected, sum))
+    assert(oldsum(P) == 1)
+end
+
+unredirected = product:resetdefinition(terra(p : Pair) : int
+    return p.a * p.b * 10
+end)
+assert(callboth(3) == 61)
+-- old callers may still reach the old body through its internal entry point
+assert(isin(unredirected, product))
+
+-- the new definition must keep the type
+local success, msg = pcall(function()
+    leaf:resetdefinition(terra(a : double) : int return 0 end)
+end)
+assert(not success)
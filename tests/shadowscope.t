@@ -0,0 +1,18 @@
+-- a variable that shadows another one in a nested scope does not hide it afterwards
+
+local x = symbol(int, "x")
+local terra shadow(a : int) : int
+	var [x] = a
+	var r = 0
+	do
+		var [x] = a * 10
+		r = r + [x]
+	end
+	r = r + [x]
+	do
+		var x = 100
+		r = r + x
+	end
+	return r + [x]
+end
+assert(shadow(2) == 20 + 2 + 100 + 2)
@@ -0,0 +1,17 @@
+-- the compilation unit caches type layouts by the address of the type object, so a
+-- new struct type must not pick up the layout of a collected one at the same address
+for i = 1, 200 do
+    local S = terralib.types.newstruct("S"..i)
+    local n = i % 7 + 1
+    for j = 1, n do
+        S.entries:insert({ field = "f"..j, type = double })
+    end
+    local terra size() : int64
+        var s : S
+        s.[ "f"..n ] = 1
+        return sizeof(S)
+    end
+    assert(size() == 8 * n)
+    assert(terralib.sizeof(S) == 8 * n)
+    collectgarbage()
+end